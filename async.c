@@ -0,0 +1,446 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Asynchronous sort submission, see ksort.h for the userspace side
+ *
+ * Every open file of the device has a struct ksort_async.  A submitted sort
+ * pins the pages of its array and maps them contiguously with vmap(), so
+ * that the work item can sort them from any kworker, then queues itself on
+ * an unbound workqueue.  Completions go to a kfifo that the submitter reaps.
+ *
+ * A slot in that kfifo is reserved at submission, so the completion of a
+ * running sort always has room; submissions fail with -EBUSY instead once
+ * KSORT_CQ_ENTRIES sorts are running or waiting to be reaped.
+ *
+ * The time of every successful sort also goes to the latency histograms of
+ * hist.c, which live as long as the workqueue.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/errno.h>
+#include <linux/eventfd.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/overflow.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "async.h"
+#include "hist.h"
+#include "ksort.h"
+#include "sort_impl.h"
+
+/* Time slice of KSORT_ALGO_MERGE between rescheduling points */
+#define ASYNC_MERGE_SLICE_NS (1000 * 1000)
+
+struct ksort_async {
+    spinlock_t lock;         /* running, cq puts and eventfd */
+    struct mutex reap_mutex; /* the single cq consumer */
+    wait_queue_head_t wait;  /* completions, and running dropping to 0 */
+    unsigned int running;
+    struct eventfd_ctx *eventfd;
+    DECLARE_KFIFO(cq, struct ksort_cqe, KSORT_CQ_ENTRIES);
+};
+
+struct ksort_request {
+    struct work_struct work;
+    struct ksort_async *ctx;
+    struct ksort_sqe sqe;
+    struct page **pages;
+    int nr_pages;
+    void *map;  /* vmap() of pages, NULL for an empty array */
+    void *base; /* first element, within map */
+};
+
+static struct workqueue_struct *ksort_wq;
+
+/* Comparators on the leading key of an element, as in the sweep benchmark
+ * of main.c; memcpy() keeps the loads valid on misaligned arrays. */
+static int cmp_u32(const void *a, const void *b)
+{
+    u32 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_u32(const void *a, const void *b)
+{
+    return cmp_u32(a, b) < 0;
+}
+
+static u64 prefix_u32(const void *a)
+{
+    u32 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_u64(const void *a, const void *b)
+{
+    return cmp_u64(a, b) < 0;
+}
+
+static u64 prefix_u64(const void *a)
+{
+    u64 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+/* KSORT_ALGO_MERGE: a ksort_job run in slices, rescheduling in between */
+static int async_merge(void *base, size_t num, size_t size, cmp_func_t cmp)
+{
+    struct ksort_job job;
+    int err = ksort_job_init(&job, base, num, size, cmp);
+
+    if (err)
+        return err;
+    while (ksort_job_run(&job, ASYNC_MERGE_SLICE_NS))
+        cond_resched();
+    ksort_job_destroy(&job);
+    return 0;
+}
+
+static int async_sort(void *base, const struct ksort_sqe *sqe)
+{
+    const bool wide = sqe->key == KSORT_KEY_U64;
+    const cmp_func_t cmp = wide ? cmp_u64 : cmp_u32;
+    const size_t num = sqe->num, size = sqe->size;
+
+    switch (sqe->algo) {
+    case KSORT_ALGO_HEAP:
+        sort_heap(base, num, size, cmp, NULL);
+        return 0;
+    case KSORT_ALGO_INTRO:
+        sort_intro(base, num, size, cmp, NULL);
+        return 0;
+    case KSORT_ALGO_PDQSORT:
+        sort_pdqsort(base, num, size, wide ? less_u64 : less_u32, NULL);
+        return 0;
+    case KSORT_ALGO_INDIRECT:
+        return ksort_indirect(base, num, size, cmp,
+                              wide ? prefix_u64 : prefix_u32);
+    default:
+        return async_merge(base, num, size, cmp);
+    }
+}
+
+/* Post a completion into the slot reserved at submission */
+static void async_complete(struct ksort_async *ctx,
+                           const struct ksort_cqe *cqe)
+{
+    /*
+     * Everything happens under the lock: ksort_async_destroy() may free
+     * ctx as soon as it sees running drop to 0 with the lock released.
+     */
+    spin_lock(&ctx->lock);
+    kfifo_put(&ctx->cq, *cqe);
+    ctx->running--;
+    if (ctx->eventfd)
+        eventfd_signal(ctx->eventfd, 1);
+    wake_up(&ctx->wait);
+    spin_unlock(&ctx->lock);
+}
+
+static void async_release(struct ksort_request *req)
+{
+    if (req->map)
+        vunmap(req->map);
+    if (req->nr_pages)
+        unpin_user_pages_dirty_lock(req->pages, req->nr_pages, true);
+    kvfree(req->pages);
+    kfree(req);
+}
+
+static void async_work(struct work_struct *work)
+{
+    struct ksort_request *req =
+        container_of(work, struct ksort_request, work);
+    struct ksort_async *ctx = req->ctx;
+    struct ksort_cqe cqe = {.user_data = req->sqe.user_data};
+    ktime_t kt;
+
+    kt = ktime_get();
+    cqe.res = req->base ? async_sort(req->base, &req->sqe) : 0;
+    cqe.ns = ktime_to_ns(ktime_sub(ktime_get(), kt));
+    if (!cqe.res)
+        ksort_hist_record(req->sqe.algo, req->sqe.num, cqe.ns);
+
+    async_release(req);
+    async_complete(ctx, &cqe);
+}
+
+/**
+ * async_map - pin and map the array of a request
+ * @req: request with its sqe filled in
+ *
+ * Returns 0, or a negative errno with nothing left pinned or mapped.
+ */
+static int async_map(struct ksort_request *req)
+{
+    const unsigned long offset = offset_in_page(req->sqe.addr);
+    u64 bytes;
+    int pinned;
+
+    if (check_mul_overflow(req->sqe.num, (u64) req->sqe.size, &bytes) ||
+        bytes > ((u64) INT_MAX << PAGE_SHIFT) - offset)
+        return -EINVAL;
+    if (!bytes)
+        return 0;
+
+    req->nr_pages = DIV_ROUND_UP(offset + bytes, PAGE_SIZE);
+    req->pages = kvmalloc_array(req->nr_pages, sizeof(*req->pages),
+                                GFP_KERNEL);
+    if (!req->pages)
+        return -ENOMEM;
+
+    pinned = pin_user_pages_fast(req->sqe.addr - offset, req->nr_pages,
+                                 FOLL_WRITE, req->pages);
+    if (pinned != req->nr_pages) {
+        if (pinned > 0)
+            unpin_user_pages(req->pages, pinned);
+        req->nr_pages = 0;
+        return pinned < 0 ? pinned : -EFAULT;
+    }
+
+    req->map = vmap(req->pages, req->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (!req->map)
+        return -ENOMEM;
+    req->base = req->map + offset;
+    return 0;
+}
+
+/**
+ * async_queue - validate, pin and queue one sort
+ * @ctx: queue of the submitting file
+ * @sqe: the sort, already copied from userspace
+ *
+ * Returns 0, -EINVAL for a malformed sqe, -E2BIG for one that would hog
+ * its kworker, -EBUSY if the completion ring has no free slot, or the error
+ * of pinning the array.
+ */
+static int async_queue(struct ksort_async *ctx, const struct ksort_sqe *sqe)
+{
+    const u32 key_size = sqe->key == KSORT_KEY_U64 ? sizeof(u64) : sizeof(u32);
+    struct ksort_request *req;
+    int err;
+
+    if (sqe->algo > KSORT_ALGO_MERGE || sqe->key > KSORT_KEY_U64 ||
+        sqe->size < key_size)
+        return -EINVAL;
+    /* Only the merge is sliced; the others reschedule in cooperative mode */
+    if (sqe->algo != KSORT_ALGO_MERGE && sqe->num > KSORT_ASYNC_MAX_NUM &&
+        !ksort_cooperative)
+        return -E2BIG;
+
+    req = kzalloc(sizeof(*req), GFP_KERNEL);
+    if (!req)
+        return -ENOMEM;
+    req->ctx = ctx;
+    req->sqe = *sqe;
+
+    spin_lock(&ctx->lock);
+    if (ctx->running + kfifo_len(&ctx->cq) >= KSORT_CQ_ENTRIES) {
+        spin_unlock(&ctx->lock);
+        kfree(req);
+        return -EBUSY;
+    }
+    ctx->running++;
+    spin_unlock(&ctx->lock);
+
+    err = async_map(req);
+    if (err) {
+        async_release(req);
+        spin_lock(&ctx->lock);
+        ctx->running--;
+        wake_up(&ctx->wait);
+        spin_unlock(&ctx->lock);
+        return err;
+    }
+
+    INIT_WORK(&req->work, async_work);
+    queue_work(ksort_wq, &req->work);
+    return 0;
+}
+
+static long async_submit(struct ksort_async *ctx,
+                         struct ksort_submit __user *argp)
+{
+    const struct ksort_sqe __user *sqes;
+    struct ksort_submit s;
+    struct ksort_sqe sqe;
+    u32 n;
+    int err = 0;
+
+    if (copy_from_user(&s, argp, sizeof(s)))
+        return -EFAULT;
+    sqes = u64_to_user_ptr(s.sqes);
+
+    for (n = 0; n < s.nr; n++) {
+        if (copy_from_user(&sqe, sqes + n, sizeof(sqe))) {
+            err = -EFAULT;
+            break;
+        }
+        err = async_queue(ctx, &sqe);
+        if (err)
+            break;
+    }
+
+    return n ? (long) n : err;
+}
+
+static long async_reap(struct ksort_async *ctx, struct ksort_reap __user *argp)
+{
+    struct ksort_cqe __user *cqes;
+    struct ksort_reap r;
+    struct ksort_cqe cqe;
+    u32 n;
+    int err = 0;
+
+    if (copy_from_user(&r, argp, sizeof(r)))
+        return -EFAULT;
+    cqes = u64_to_user_ptr(r.cqes);
+
+    /*
+     * Workers only ever add to the kfifo, so the one consumer can peek
+     * without the lock, and a cqe stays queued if it can't be copied out.
+     */
+    mutex_lock(&ctx->reap_mutex);
+    for (n = 0; n < r.nr && kfifo_peek(&ctx->cq, &cqe); n++) {
+        if (copy_to_user(cqes + n, &cqe, sizeof(cqe))) {
+            err = -EFAULT;
+            break;
+        }
+        kfifo_skip(&ctx->cq);
+    }
+    mutex_unlock(&ctx->reap_mutex);
+
+    return n ? (long) n : err;
+}
+
+static long async_set_eventfd(struct ksort_async *ctx, int __user *argp)
+{
+    struct eventfd_ctx *ev = NULL, *old;
+    int fd;
+
+    if (get_user(fd, argp))
+        return -EFAULT;
+    if (fd >= 0) {
+        ev = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ev))
+            return PTR_ERR(ev);
+    }
+
+    spin_lock(&ctx->lock);
+    old = ctx->eventfd;
+    ctx->eventfd = ev;
+    spin_unlock(&ctx->lock);
+
+    if (old)
+        eventfd_ctx_put(old);
+    return 0;
+}
+
+long ksort_async_ioctl(struct ksort_async *ctx,
+                       unsigned int cmd,
+                       unsigned long arg)
+{
+    switch (cmd) {
+    case KSORT_IOC_SUBMIT:
+        return async_submit(ctx, (struct ksort_submit __user *) arg);
+    case KSORT_IOC_REAP:
+        return async_reap(ctx, (struct ksort_reap __user *) arg);
+    case KSORT_IOC_SET_EVENTFD:
+        return async_set_eventfd(ctx, (int __user *) arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+__poll_t ksort_async_poll(struct ksort_async *ctx,
+                          struct file *filep,
+                          poll_table *wait)
+{
+    poll_wait(filep, &ctx->wait, wait);
+    return kfifo_is_empty(&ctx->cq) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+struct ksort_async *ksort_async_create(void)
+{
+    struct ksort_async *ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+
+    if (!ctx)
+        return NULL;
+    spin_lock_init(&ctx->lock);
+    mutex_init(&ctx->reap_mutex);
+    init_waitqueue_head(&ctx->wait);
+    INIT_KFIFO(ctx->cq);
+    return ctx;
+}
+
+static bool async_idle(struct ksort_async *ctx)
+{
+    bool idle;
+
+    spin_lock(&ctx->lock);
+    idle = !ctx->running;
+    spin_unlock(&ctx->lock);
+    return idle;
+}
+
+/**
+ * ksort_async_destroy - free the queue of a file being released
+ * @ctx: queue from ksort_async_create()
+ *
+ * Waits for the sorts still running; their completions are dropped.
+ */
+void ksort_async_destroy(struct ksort_async *ctx)
+{
+    wait_event(ctx->wait, async_idle(ctx));
+    if (ctx->eventfd)
+        eventfd_ctx_put(ctx->eventfd);
+    mutex_destroy(&ctx->reap_mutex);
+    kfree(ctx);
+}
+
+int ksort_async_init(void)
+{
+    int err = ksort_hist_init();
+
+    if (err)
+        return err;
+    ksort_wq = alloc_workqueue("ksort", WQ_UNBOUND, 0);
+    if (!ksort_wq) {
+        ksort_hist_exit();
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void ksort_async_exit(void)
+{
+    destroy_workqueue(ksort_wq);
+    ksort_hist_exit();
+}
@@ -0,0 +1,24 @@
+#ifndef KSORT_ASYNC_H
+#define KSORT_ASYNC_H
+
+/*
+ * Asynchronous sort queue behind the ioctls of ksort.h, see async.c.  The
+ * device creates one per open file; ksort_async_init() sets up the
+ * workqueue shared by all of them and the latency histograms of hist.c.
+ */
+struct ksort_async;
+
+extern int ksort_async_init(void);
+extern void ksort_async_exit(void);
+
+extern struct ksort_async *ksort_async_create(void);
+extern void ksort_async_destroy(struct ksort_async *ctx);
+
+extern long ksort_async_ioctl(struct ksort_async *ctx,
+                              unsigned int cmd,
+                              unsigned long arg);
+extern __poll_t ksort_async_poll(struct ksort_async *ctx,
+                                 struct file *filep,
+                                 poll_table *wait);
+
+#endif
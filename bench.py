@@ -0,0 +1,416 @@
+#!/usr/bin/env python3
+# Benchmark driver for ksort_user, the userspace build of the engines.
+#
+# Runs every cell of a matrix of sort x elements x distribution x element
+# size, in a random order that is drawn again on every pass, so that drift
+# of the machine (frequency, thermals, other load) spreads over all cells
+# instead of biasing the ones that happen to run last.  Each pass adds a
+# batch of samples to every cell whose confidence interval is still too
+# wide; a cell is done once the bootstrap CI of its median is within
+# --rel-ci of the median, or after --max-reps samples.  Every batch sorts a
+# fresh input (its own seed), so the CIs cover input variation too.
+#
+# Every sort is then compared with --baseline in the same cell, with a
+# Mann-Whitney U test (default) or Welch's t-test, with Holm's correction
+# over all comparisons of the run.
+#
+# Output, in --out:
+#   samples.csv  every sample
+#   results.csv  one row per cell: median and its CI, mean, stdev
+#   compare.csv  the comparisons with the baseline
+#   results.json all of the above with a manifest of host, CPU, kernel,
+#                compiler and git commit
+#   <dist>-<bytes>.dat/.gp/.png  log-log ns/element against elements, one
+#                line per sort; the png needs gnuplot
+#
+# Example:
+#   make ksort_user
+#   ./bench.py --sorts pdqsort,intro,tim,power --sizes 1000,100000 \
+#              --dists random,runs --elem-sizes 8
+
+import argparse
+import csv
+import datetime
+import itertools
+import json
+import math
+import os
+import platform
+import random
+import shutil
+import socket
+import subprocess
+import sys
+
+import numpy as np
+
+DEFAULT_SIZES = [1000, 10000, 100000, 1000000]
+
+# Quadratic sorts that ksort_user leaves out above 20000 elements
+SLOW_SORTS = {'binary_insertion', 'selection', 'bubble', 'bitonic'}
+
+
+def list_sorts(binary):
+    # name -> whether it takes any element size, from "ksort_user -l"
+    out = subprocess.run([binary, '-l'], check=True, capture_output=True,
+                         text=True).stdout
+    sorts = {}
+    for line in out.splitlines():
+        name, sizes = line.split()
+        sorts[name] = sizes == 'any'
+    return sorts
+
+
+def run_batch(binary, cell, rounds, warmup, seed):
+    sort, n, dist, size = cell
+    cmd = [binary, '-R', '-s', sort, '-n', str(n), '-d', dist,
+           '-e', str(size), '-r', str(rounds + warmup), '-S', str(seed)]
+    res = subprocess.run(cmd, capture_output=True, text=True)
+    if res.returncode != 0:
+        sys.exit('{} failed:\n{}'.format(' '.join(cmd), res.stderr))
+    times = [int(line.split()[3]) for line in res.stdout.splitlines()
+             if not line.startswith('#')]
+    return times[warmup:]
+
+
+def bootstrap_ci(samples, confidence, resamples, rng):
+    # Percentile bootstrap of the median
+    samples = np.asarray(samples, dtype=float)
+    idx = rng.integers(0, len(samples), size=(resamples, len(samples)))
+    medians = np.median(samples[idx], axis=1)
+    alpha = (1 - confidence) / 2
+    lo, hi = np.quantile(medians, [alpha, 1 - alpha])
+    return float(lo), float(hi)
+
+
+def norm_sf(z):
+    return 0.5 * math.erfc(z / math.sqrt(2))
+
+
+def betacf(a, b, x):
+    # Continued fraction of the incomplete beta function (Lentz)
+    tiny = 1e-300
+    c, d = 1.0, 1.0 - (a + b) * x / (a + 1)
+    d = 1 / (d if abs(d) > tiny else tiny)
+    h = d
+    for m in range(1, 300):
+        for num in (m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)),
+                    -(a + m) * (a + b + m) * x / ((a + 2 * m) *
+                                                  (a + 2 * m + 1))):
+            d = 1 + num * d
+            d = 1 / (d if abs(d) > tiny else tiny)
+            c = 1 + num / c
+            c = c if abs(c) > tiny else tiny
+            h *= d * c
+        if abs(d * c - 1) < 1e-15:
+            break
+    return h
+
+
+def betainc(a, b, x):
+    # Regularized incomplete beta function I_x(a, b)
+    if x <= 0:
+        return 0.0
+    if x >= 1:
+        return 1.0
+    lbeta = math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+    front = math.exp(lbeta + a * math.log(x) + b * math.log1p(-x))
+    if x < (a + 1) / (a + b + 2):
+        return front * betacf(a, b, x) / a
+    return 1 - front * betacf(b, a, 1 - x) / b
+
+
+def welch(x, y):
+    # Two-sided Welch's t-test; returns the p-value
+    x, y = np.asarray(x, dtype=float), np.asarray(y, dtype=float)
+    vx, vy = x.var(ddof=1) / len(x), y.var(ddof=1) / len(y)
+    if vx + vy == 0:
+        return 1.0 if x.mean() == y.mean() else 0.0
+    t = (x.mean() - y.mean()) / math.sqrt(vx + vy)
+    df = (vx + vy) ** 2 / (vx ** 2 / (len(x) - 1) + vy ** 2 / (len(y) - 1))
+    return betainc(df / 2, 0.5, df / (df + t * t))
+
+
+def mann_whitney(x, y):
+    # Two-sided Mann-Whitney U test, normal approximation with the tie
+    # correction; fine for the 10 or more samples every cell has
+    n1, n2 = len(x), len(y)
+    both = np.concatenate([x, y]).astype(float)
+    order = both.argsort(kind='mergesort')
+    ranks = np.empty(len(both))
+    sorted_vals = both[order]
+    i = 0
+    ties = 0.0
+    while i < len(both):
+        j = i
+        while j + 1 < len(both) and sorted_vals[j + 1] == sorted_vals[i]:
+            j += 1
+        ranks[order[i:j + 1]] = (i + j) / 2 + 1
+        t = j - i + 1
+        ties += t ** 3 - t
+        i = j + 1
+    u = ranks[:n1].sum() - n1 * (n1 + 1) / 2
+    n = n1 + n2
+    sigma = math.sqrt(n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2) - 0.5) / sigma
+    return min(1.0, 2 * norm_sf(max(z, 0.0)))
+
+
+def holm(pvalues):
+    # Holm-Bonferroni adjusted p-values, in the original order
+    m = len(pvalues)
+    adjusted = [0.0] * m
+    running = 0.0
+    for rank, i in enumerate(sorted(range(m), key=lambda i: pvalues[i])):
+        running = max(running, min(1.0, (m - rank) * pvalues[i]))
+        adjusted[i] = running
+    return adjusted
+
+
+def read_first(path):
+    try:
+        with open(path) as f:
+            return f.readline().strip()
+    except OSError:
+        return None
+
+
+def manifest(args, binary):
+    cpu = None
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('model name'):
+                    cpu = line.split(':', 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    repo = os.path.dirname(os.path.abspath(__file__))
+    try:
+        commit = subprocess.run(['git', '-C', repo, 'rev-parse', 'HEAD'],
+                                capture_output=True, text=True,
+                                check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        commit = None
+    try:
+        cc = subprocess.run([os.environ.get('CC', 'cc'), '--version'],
+                            capture_output=True, text=True,
+                            check=True).stdout.splitlines()[0]
+    except (OSError, subprocess.CalledProcessError, IndexError):
+        cc = None
+    uname = platform.uname()
+    return {
+        'date': datetime.datetime.now(datetime.timezone.utc).isoformat(),
+        'host': socket.gethostname(),
+        'kernel': uname.release,
+        'kernel_version': uname.version,
+        'machine': uname.machine,
+        'cpu': cpu,
+        'cpus': os.cpu_count(),
+        'governor': read_first(
+            '/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor'),
+        'compiler': cc,
+        'commit': commit,
+        'binary': binary,
+        'python': platform.python_version(),
+        'numpy': np.__version__,
+        'argv': sys.argv,
+        'options': vars(args),
+    }
+
+
+def write_plots(out, cells, stats, sorts):
+    gnuplot = shutil.which('gnuplot')
+    groups = sorted({(dist, size) for _, _, dist, size in cells})
+    for dist, size in groups:
+        name = '{}-{}'.format(dist, size)
+        dat = os.path.join(out, name + '.dat')
+        names = []
+        with open(dat, 'w') as f:
+            # One gnuplot data block per sort: elements, median ns/element
+            # and its CI
+            for sort in sorts:
+                rows = [(c[1], stats[c]) for c in cells
+                        if c[0] == sort and c[2] == dist and c[3] == size]
+                if not rows:
+                    continue
+                names.append(sort)
+                f.write('# {}\n'.format(sort))
+                for n, s in sorted(rows):
+                    f.write('{} {:.4f} {:.4f} {:.4f}\n'.format(
+                        n, s['median'] / n, s['ci_lo'] / n, s['ci_hi'] / n))
+                f.write('\n\n')
+        gp = os.path.join(out, name + '.gp')
+        with open(gp, 'w') as f:
+            f.write("reset\n"
+                    "set ylabel 'time per element (nsec)'\n"
+                    "set xlabel 'elements'\n"
+                    "set title '{} input, {}-byte elements'\n"
+                    "set term png enhanced font 'Verdana,10'\n"
+                    "set output '{}.png'\n"
+                    "set logscale xy\n"
+                    "set key left top\n\n".format(dist, size, name))
+            f.write('plot ' + ', \\\n'.join(
+                "'{}.dat' index {} using 1:2:3:4 with yerrorlines "
+                "linewidth 1 title '{}'".format(name, i, sort.replace('_', ' '))
+                for i, sort in enumerate(names)) + '\n')
+        if gnuplot:
+            subprocess.run([gnuplot, name + '.gp'], cwd=out, check=True)
+    if not gnuplot:
+        print('gnuplot not found, plots left as .gp scripts in ' + out)
+
+
+def parse_list(s, conv=str):
+    return [conv(e) for e in s.split(',') if e]
+
+
+def main():
+    p = argparse.ArgumentParser(
+        description='Statistically rigorous benchmark of the ksort engines')
+    p.add_argument('--binary', default='./ksort_user')
+    p.add_argument('--sorts', default='',
+                   help='comma-separated, default all but the quadratic ones')
+    p.add_argument('--sizes', default=','.join(map(str, DEFAULT_SIZES)),
+                   help='numbers of elements')
+    p.add_argument('--dists', default='random,runs')
+    p.add_argument('--elem-sizes', default='8',
+                   help='element sizes in bytes; sorts that only take 8 '
+                   'are skipped for the others')
+    p.add_argument('--batch', type=int, default=5,
+                   help='samples added to a cell per pass')
+    p.add_argument('--warmup', type=int, default=1,
+                   help='sorts run and dropped before every batch')
+    p.add_argument('--min-reps', type=int, default=10)
+    p.add_argument('--max-reps', type=int, default=200)
+    p.add_argument('--rel-ci', type=float, default=0.02,
+                   help='target CI half-width, relative to the median')
+    p.add_argument('--confidence', type=float, default=0.95)
+    p.add_argument('--resamples', type=int, default=2000,
+                   help='bootstrap resamples')
+    p.add_argument('--baseline', default='pdqsort')
+    p.add_argument('--test', choices=['mannwhitney', 'welch'],
+                   default='mannwhitney')
+    p.add_argument('--alpha', type=float, default=0.05)
+    p.add_argument('--seed', type=int, default=None,
+                   help='seed of the run order and inputs, for reruns')
+    p.add_argument('--out', default='bench-out')
+    args = p.parse_args()
+
+    binary = os.path.abspath(args.binary)
+    if not os.access(binary, os.X_OK):
+        sys.exit('{} not found, run "make ksort_user" first'.format(binary))
+    available = list_sorts(binary)
+    sorts = parse_list(args.sorts) or [s for s in available
+                                        if s not in SLOW_SORTS]
+    for s in sorts:
+        if s not in available:
+            sys.exit('no sort {}, see {} -l'.format(s, binary))
+    sizes = parse_list(args.sizes, int)
+    dists = parse_list(args.dists)
+    elem_sizes = parse_list(args.elem_sizes, int)
+
+    seed = args.seed if args.seed is not None else random.randrange(2 ** 32)
+    args.seed = seed
+    order_rng = random.Random(seed)
+    boot_rng = np.random.default_rng(seed)
+
+    cells = [c for c in itertools.product(sorts, sizes, dists, elem_sizes)
+             if available[c[0]] or c[3] == 8]
+    samples = {c: [] for c in cells}
+    stats = {}
+    pending = list(cells)
+
+    passes = 0
+    while pending:
+        passes += 1
+        order_rng.shuffle(pending)
+        for c in pending:
+            samples[c] += run_batch(binary, c, args.batch, args.warmup,
+                                    order_rng.randrange(1, 2 ** 63))
+        still = []
+        for c in pending:
+            x = samples[c]
+            med = float(np.median(x))
+            lo, hi = bootstrap_ci(x, args.confidence, args.resamples,
+                                  boot_rng)
+            converged = (hi - lo) / 2 <= args.rel_ci * med
+            stats[c] = {'reps': len(x), 'median': med, 'ci_lo': lo,
+                        'ci_hi': hi, 'mean': float(np.mean(x)),
+                        'stdev': float(np.std(x, ddof=1)),
+                        'converged': converged}
+            if len(x) < args.max_reps and (len(x) < args.min_reps or
+                                           not converged):
+                still.append(c)
+        print('pass {}: {} of {} cells still open'.format(passes, len(still),
+                                                          len(cells)),
+              file=sys.stderr)
+        pending = still
+
+    test = welch if args.test == 'welch' else mann_whitney
+    compare = []
+    for c in cells:
+        base = (args.baseline, c[1], c[2], c[3])
+        if c[0] == args.baseline or base not in samples:
+            continue
+        compare.append({
+            'sort': c[0], 'elements': c[1], 'dist': c[2], 'bytes': c[3],
+            'baseline': args.baseline,
+            'ratio': stats[c]['median'] / stats[base]['median'],
+            'p': float(test(samples[c], samples[base])),
+        })
+    for row, adj in zip(compare, holm([r['p'] for r in compare])):
+        row['p_holm'] = float(adj)
+        row['significant'] = bool(adj < args.alpha)
+
+    os.makedirs(args.out, exist_ok=True)
+    with open(os.path.join(args.out, 'samples.csv'), 'w', newline='') as f:
+        w = csv.writer(f)
+        w.writerow(['sort', 'elements', 'dist', 'bytes', 'ns'])
+        for c in cells:
+            for ns in samples[c]:
+                w.writerow([*c, ns])
+    fields = ['reps', 'median', 'ci_lo', 'ci_hi', 'mean', 'stdev',
+              'converged']
+    with open(os.path.join(args.out, 'results.csv'), 'w', newline='') as f:
+        w = csv.writer(f)
+        w.writerow(['sort', 'elements', 'dist', 'bytes', *fields,
+                    'ns_per_element'])
+        for c in cells:
+            s = stats[c]
+            w.writerow([*c, *[s[k] for k in fields], s['median'] / c[1]])
+    cfields = ['sort', 'elements', 'dist', 'bytes', 'baseline', 'ratio', 'p',
+               'p_holm', 'significant']
+    with open(os.path.join(args.out, 'compare.csv'), 'w', newline='') as f:
+        w = csv.DictWriter(f, fieldnames=cfields)
+        w.writeheader()
+        w.writerows(compare)
+    with open(os.path.join(args.out, 'results.json'), 'w') as f:
+        json.dump({
+            'manifest': manifest(args, binary),
+            'test': args.test,
+            'cells': [dict(zip(['sort', 'elements', 'dist', 'bytes'], c),
+                           **stats[c]) for c in cells],
+            'compare': compare,
+        }, f, indent=2)
+    write_plots(args.out, cells, stats, sorts)
+
+    print('{:<18} {:>9} {:<7} {:>5} {:>5} {:>12} {:>21} {:>8} {:>9}'.format(
+        'sort', 'elements', 'dist', 'bytes', 'reps', 'median', 'ci',
+        'ns/elem', 'vs ' + args.baseline))
+    by_cell = {(r['sort'], r['elements'], r['dist'], r['bytes']): r
+               for r in compare}
+    for c in cells:
+        s = stats[c]
+        r = by_cell.get(c)
+        vs = '-' if r is None else '{:.2f}{}'.format(
+            r['ratio'], '*' if r['significant'] else '')
+        print('{:<18} {:>9} {:<7} {:>5} {:>5} {:>12.0f} {:>21} {:>8.2f} '
+              '{:>9}'.format(*c, s['reps'], s['median'],
+                             '{:.0f}-{:.0f}'.format(s['ci_lo'], s['ci_hi']),
+                             s['median'] / c[1], vs))
+
+
+if __name__ == '__main__':
+    main()
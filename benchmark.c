@@ -1,58 +1,543 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "ksort.h"
+
 #define XORO_DEV "/dev/xoroshiro128p"
 
 #define TEST_TIME 1
 #define EXPERIMENT 100
+#define MAX_CPUS 1024
+
+/* Sorts per batch of the async mode, elements per sort, and batches */
+#define ASYNC_BATCH 64
+#define ASYNC_LEN 10000
+#define ASYNC_ROUNDS 10
+
+/* Element sizes and engines of the element-size sweep, in the order main.c
+ * reports them; load the module with bench_sweep=1 to get this mode. */
+static const int sweep_sizes[] = {4, 8, 12, 16, 24, 32, 64, 128, 256};
+static const char *sweep_engines[] = {"heap", "intro", "pdqsort", "indirect"};
+#define SWEEP_SIZES 9
+#define SWEEP_ENGINES 4
+#define SWEEP_SAMPLES (SWEEP_SIZES * 2 * SWEEP_ENGINES)
+
+/* Names of the sorts of read(), in the order of bench_sorts in main.c */
+static const char *const bench_names[] = {
+    "kernel_heap_sort",
+    "merge_sort",
+    "shell_sort",
+    "binary_insertion_sort",
+    "heap_sort",
+    "quick_sort",
+    "selection_sort",
+    "tim_sort",
+    "bubble_sort",
+    "bitonic_sort",
+    "merge_sort_in_place",
+    "grail_sort",
+    "sqrt_sort",
+    "rec_stable_sort",
+    "grail_sort_dyn_buffer",
+    "intro_sort",
+    "pdquick_sort",
+    "power_sort",
+    "merge_sort_bottom_up",
+    "radix_sort",
+    "auto_sort",
+    "kv_quick_sort",
+    "kv_merge_sort",
+    "kv_radix_sort",
+    "weak_heap_sort",
+    "smooth_sort",
+};
+_Static_assert(sizeof(bench_names) / sizeof(bench_names[0]) ==
+                   KSORT_BENCH_SORTS,
+               "bench_names must match the sorts of the module");
+
+/* Header line of the per-sort outputs, for outlier.py; prefix names a
+ * leading column */
+static void print_names(const char *prefix)
+{
+    printf("#");
+    if (prefix)
+        printf(" %s", prefix);
+    for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+        printf(" %s", bench_names[i]);
+    printf("\n");
+}
+
+/* Print one line per element size and alignment with the mean time of every
+ * engine over EXPERIMENT reads. */
+static int sweep(int fd)
+{
+    uint64_t buf[SWEEP_SAMPLES];
+    double mean[SWEEP_SAMPLES] = {0};
+
+    for (int e = 0; e < EXPERIMENT; ++e) {
+        if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            perror("Failed to read the element size sweep");
+            return 1;
+        }
+        for (int i = 0; i < SWEEP_SAMPLES; ++i)
+            mean[i] += (double) buf[i] / EXPERIMENT;
+    }
+
+    printf("# size misaligned");
+    for (int k = 0; k < SWEEP_ENGINES; ++k)
+        printf(" %s", sweep_engines[k]);
+    printf("\n");
+    for (int s = 0; s < SWEEP_SIZES; ++s) {
+        for (int a = 0; a < 2; ++a) {
+            printf("%d %d", sweep_sizes[s], a);
+            for (int k = 0; k < SWEEP_ENGINES; ++k)
+                printf(" %.0f", mean[(s * 2 + a) * SWEEP_ENGINES + k]);
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+/* APIs of the selection benchmark, in the order main.c reports them; load
+ * the module with bench_select=1 to get this mode. */
+static const char *select_apis[] = {"pdqsort", "select", "partial_sort",
+                                    "topk", "topk_stream"};
+#define SELECT_APIS 5
+
+/* Print the mean time of every API over EXPERIMENT reads. */
+static int select_mode(int fd)
+{
+    uint64_t buf[SELECT_APIS];
+    double mean[SELECT_APIS] = {0};
+
+    for (int e = 0; e < EXPERIMENT; ++e) {
+        if (read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+            perror("Failed to read the selection benchmark");
+            return 1;
+        }
+        for (int i = 0; i < SELECT_APIS; ++i)
+            mean[i] += (double) buf[i] / EXPERIMENT;
+    }
+
+    for (int i = 0; i < SELECT_APIS; ++i)
+        printf("%s %.0f\n", select_apis[i], mean[i]);
+    return 0;
+}
+
+/* One sort of the async mode: its sqe, and the sum of its keys, which the
+ * sort must keep */
+struct async_sort {
+    struct ksort_sqe sqe;
+    uint64_t sum;
+    int done;
+};
+
+static uint64_t async_key(const struct ksort_sqe *sqe, uint64_t i)
+{
+    const char *elem = (const char *) (uintptr_t) sqe->addr + i * sqe->size;
+    uint64_t key64;
+    uint32_t key32;
+
+    if (sqe->key == KSORT_KEY_U64) {
+        memcpy(&key64, elem, sizeof(key64));
+        return key64;
+    }
+    memcpy(&key32, elem, sizeof(key32));
+    return key32;
+}
+
+/* Fill sorts[0..nr) with random arrays of len elements, cycling through the
+ * engines, both key types and a few element sizes; user_data of a sort is
+ * its index with a cookie in the upper half, so stray values show up. */
+static int async_fill(struct async_sort *sorts, int nr, uint64_t len)
+{
+    for (int i = 0; i < nr; ++i) {
+        struct ksort_sqe *sqe = &sorts[i].sqe;
+        const int wide = (i / 5) % 2;
+        const uint32_t size = (wide ? 8 : 4) * (1 + i % 3);
+        char *buf;
+
+        free((void *) (uintptr_t) sqe->addr);
+        buf = malloc(len * size);
+        if (!buf) {
+            perror("Failed to allocate the async sorts");
+            return 1;
+        }
+        for (uint64_t b = 0; b < len * size; ++b)
+            buf[b] = rand();
+
+        *sqe = (struct ksort_sqe){
+            .user_data = (uint64_t) 0x6b736f72 << 32 | i,
+            .addr = (uintptr_t) buf,
+            .num = len,
+            .size = size,
+            .algo = i % 5,
+            .key = wide ? KSORT_KEY_U64 : KSORT_KEY_U32,
+        };
+        sorts[i].sum = 0;
+        for (uint64_t e = 0; e < len; ++e)
+            sorts[i].sum += async_key(sqe, e);
+        sorts[i].done = 0;
+    }
+    return 0;
+}
+
+static int async_submit(int fd, struct async_sort *sorts, int nr)
+{
+    struct ksort_sqe sqes[KSORT_CQ_ENTRIES + 1];
+    struct ksort_submit sub = {.sqes = (uintptr_t) sqes, .nr = nr};
+
+    for (int i = 0; i < nr; ++i)
+        sqes[i] = sorts[i].sqe;
+    return ioctl(fd, KSORT_IOC_SUBMIT, &sub);
+}
+
+/* Check a completion against its sort; returns the number of failures */
+static int async_check(struct async_sort *sorts,
+                       int nr,
+                       const struct ksort_cqe *cqe)
+{
+    const uint64_t i = cqe->user_data & 0xffffffff;
+    struct async_sort *s = &sorts[i];
+    uint64_t sum;
+
+    if (cqe->user_data >> 32 != 0x6b736f72 || i >= (uint64_t) nr ||
+        s->done) {
+        fprintf(stderr, "async: unexpected user_data %#llx\n",
+                (unsigned long long) cqe->user_data);
+        return 1;
+    }
+    s->done = 1;
+    if (cqe->res) {
+        fprintf(stderr, "async: sort %lu failed: %s\n", i,
+                strerror(-cqe->res));
+        return 1;
+    }
+
+    sum = async_key(&s->sqe, 0);
+    for (uint64_t e = 1; e < s->sqe.num; ++e) {
+        if (async_key(&s->sqe, e - 1) > async_key(&s->sqe, e)) {
+            fprintf(stderr, "async: sort %lu (algo %u) is out of order\n",
+                    i, s->sqe.algo);
+            return 1;
+        }
+        sum += async_key(&s->sqe, e);
+    }
+    if (s->sqe.num && sum != s->sum) {
+        fprintf(stderr, "async: sort %lu (algo %u) lost elements\n", i,
+                s->sqe.algo);
+        return 1;
+    }
+    return 0;
+}
+
+/* Wait with poll() for the nr sorts submitted from sorts, reaping and
+ * checking every completion; returns the number of failures, and adds the
+ * eventfd count to *events and the sort times to *ns. */
+static int async_wait(int fd,
+                      int efd,
+                      struct async_sort *sorts,
+                      int nr,
+                      uint64_t *events,
+                      uint64_t *ns)
+{
+    struct ksort_cqe cqes[32];
+    struct ksort_reap reap = {.cqes = (uintptr_t) cqes, .nr = 32};
+    int reaped = 0, failed = 0;
+
+    while (reaped < nr) {
+        struct pollfd fds[2] = {{.fd = fd, .events = POLLIN},
+                                {.fd = efd, .events = POLLIN}};
+        uint64_t count;
+        int ret = poll(fds, 2, 10000);
 
-int main()
-{
-    uint64_t buf[17] = {0};
-    uint64_t times[EXPERIMENT][17] = {0};
-    char *names[] = {"kernel_heap_sort",
-                     "merge_sort",
-                     "shell_sort",
-                     "binary_insertion_sort",
-                     "heap_sort",
-                     "quick_sort",
-                     "selection_sort",
-                     "tim_sort",
-                     "bubble_sort",
-                     "bitonic_sort",
-                     "merge_sort_in_place",
-                     "grail_sort",
-                     "sqrt_sort",
-                     "rec_stable_sort",
-                     "grail_sort_dyn_buffer",
-                     "intro_sort",
-                     "pdquick_sort"};
+        if (ret <= 0) {
+            fprintf(stderr, "async: %s waiting for %d completions\n",
+                    ret ? strerror(errno) : "timed out", nr - reaped);
+            return failed + nr - reaped;
+        }
+        if ((fds[1].revents & POLLIN) &&
+            read(efd, &count, sizeof(count)) == sizeof(count))
+            *events += count;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        ret = ioctl(fd, KSORT_IOC_REAP, &reap);
+        if (ret < 0) {
+            perror("Failed to reap the async sorts");
+            return failed + nr - reaped;
+        }
+        for (int c = 0; c < ret; ++c) {
+            failed += async_check(sorts, nr, &cqes[c]);
+            *ns += cqes[c].ns;
+        }
+        reaped += ret;
+    }
+    return failed;
+}
+
+/* Sort ASYNC_ROUNDS batches of ASYNC_BATCH arrays through the async queue,
+ * printing the wall time and mean sort time of each batch, then fill the
+ * completion ring to check that a full ring turns submissions away with
+ * EBUSY.  Every completion and every sorted array is checked, and so is the
+ * eventfd count. */
+static int async_mode(int fd)
+{
+    static struct async_sort sorts[KSORT_CQ_ENTRIES + 1];
+    uint64_t events = 0, completions = 0, ns = 0, count;
+    int efd, ret, failed = 0;
 
+    efd = eventfd(0, EFD_NONBLOCK);
+    if (efd < 0 || ioctl(fd, KSORT_IOC_SET_EVENTFD, &efd) < 0) {
+        perror("Failed to register an eventfd");
+        return 1;
+    }
+
+    printf("# sorts wall_ns mean_sort_ns\n");
+    for (int r = 0; r < ASYNC_ROUNDS; ++r) {
+        struct timespec t0, t1;
+
+        if (async_fill(sorts, ASYNC_BATCH, ASYNC_LEN))
+            return 1;
+        ns = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ret = async_submit(fd, sorts, ASYNC_BATCH);
+        if (ret != ASYNC_BATCH) {
+            fprintf(stderr, "async: queued %d of %d sorts\n", ret,
+                    ASYNC_BATCH);
+            return 1;
+        }
+        failed += async_wait(fd, efd, sorts, ASYNC_BATCH, &events, &ns);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        completions += ASYNC_BATCH;
+        printf("%d %.0f %.0f\n", ASYNC_BATCH,
+               (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec),
+               (double) ns / ASYNC_BATCH);
+    }
+
+    /* Nothing is reaped until every slot of the ring is taken, so the sort
+     * after them must be refused, then accepted once the ring is empty. */
+    if (async_fill(sorts, KSORT_CQ_ENTRIES + 1, 64))
+        return 1;
+    ret = async_submit(fd, sorts, KSORT_CQ_ENTRIES + 1);
+    if (ret != KSORT_CQ_ENTRIES) {
+        fprintf(stderr, "async: queued %d sorts into a ring of %d\n", ret,
+                KSORT_CQ_ENTRIES);
+        return 1;
+    }
+    ret = async_submit(fd, &sorts[KSORT_CQ_ENTRIES], 1);
+    if (ret >= 0 || errno != EBUSY) {
+        fprintf(stderr, "async: a full ring returned %d (%s), not EBUSY\n",
+                ret, ret < 0 ? strerror(errno) : "queued");
+        failed++;
+    }
+    failed += async_wait(fd, efd, sorts, KSORT_CQ_ENTRIES, &events, &ns);
+    completions += KSORT_CQ_ENTRIES;
+
+    /* The refused sort is checked as the only one of a batch */
+    free((void *) (uintptr_t) sorts[0].sqe.addr);
+    sorts[0] = sorts[KSORT_CQ_ENTRIES];
+    sorts[0].sqe.user_data &= ~(uint64_t) 0xffffffff;
+    memset(&sorts[KSORT_CQ_ENTRIES], 0, sizeof(sorts[0]));
+    if (async_submit(fd, sorts, 1) != 1) {
+        perror("async: the emptied ring refused a sort");
+        failed++;
+    } else {
+        failed += async_wait(fd, efd, sorts, 1, &events, &ns);
+        completions++;
+    }
+
+    if (read(efd, &count, sizeof(count)) == sizeof(count))
+        events += count;
+    if (events != completions) {
+        fprintf(stderr, "async: %lu eventfd events for %lu completions\n",
+                events, completions);
+        failed++;
+    }
+
+    efd = -1;
+    ioctl(fd, KSORT_IOC_SET_EVENTFD, &efd);
+    for (int i = 0; i <= KSORT_CQ_ENTRIES; ++i)
+        free((void *) (uintptr_t) sorts[i].sqe.addr);
+    printf("# %lu completions, %d failed\n", completions, failed);
+    return !!failed;
+}
+
+/* Print the per-CPU results of a module loaded with bench_cpus: one line per
+ * CPU and read, the row of the CPU in the list first, then the times and as
+ * many columns that are 1 where the sort was still disturbed after the
+ * reruns of bench_reject. */
+static int cpus(int fd)
+{
+    static uint64_t buf[MAX_CPUS][2 * KSORT_BENCH_SORTS];
+
+    print_names("cpu");
+    for (int e = 0; e < EXPERIMENT; ++e) {
+        ssize_t ret = read(fd, buf, sizeof(buf));
+
+        if (ret < (ssize_t) sizeof(buf[0])) {
+            perror("Failed to read the per-CPU benchmark");
+            return 1;
+        }
+        for (int c = 0; c < ret / (ssize_t) sizeof(buf[0]); ++c) {
+            printf("%d ", c);
+            for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+                printf("%lu ", buf[c][i]);
+            for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+                printf("%d ", !!(buf[c][KSORT_BENCH_SORTS + i] &
+                                 KSORT_SAMPLE_DISTURBED));
+            printf("\n");
+        }
+    }
+    return 0;
+}
+
+/* Print one round of the stream and clear it for the next, so that a sort
+ * missing from a round shows up as 0 */
+static void stream_row(uint64_t *line, int *disturbed)
+{
+    for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+        printf("%lu ", line[i]);
+    for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+        printf("%d ", disturbed[i]);
+    printf("\n");
+    memset(line, 0, KSORT_BENCH_SORTS * sizeof(*line));
+    memset(disturbed, 0, KSORT_BENCH_SORTS * sizeof(*disturbed));
+}
+
+/* Run the benchmark as a sample stream of the given number of rounds and
+ * print one line per round: the times of the read() benchmark, then as many
+ * columns that are 1 where the sample was disturbed (see ksort.h).  A round
+ * ends where algo wraps around, and the last one with the stream. */
+static int stream(int fd, uint64_t rounds)
+{
+    struct ksort_stream st = {.rounds = rounds};
+    struct ksort_ring_hdr *hdr;
+    struct ksort_sample *samples;
+    uint64_t line[KSORT_BENCH_SORTS] = {0};
+    int disturbed[KSORT_BENCH_SORTS] = {0};
+    uint32_t tail = 0, head, last = 0;
+    int pending = 0;
+    void *map;
+
+    map = mmap(NULL, KSORT_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               0);
+    if (map == MAP_FAILED) {
+        perror("Failed to map the sample ring");
+        return 1;
+    }
+    hdr = map;
+    samples = (void *) ((char *) map + KSORT_RING_SAMPLES);
+
+    if (ioctl(fd, KSORT_IOC_STREAM_START, &st) < 0) {
+        perror("Failed to start the sample stream");
+        munmap(map, KSORT_RING_SIZE);
+        return 1;
+    }
+    print_names(NULL);
+
+    for (;;) {
+        /* Check done first: samples pushed before it are then visible */
+        int done = __atomic_load_n(&hdr->done, __ATOMIC_ACQUIRE);
+
+        head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            if (done)
+                break;
+            usleep(1000);
+            continue;
+        }
+        for (; tail != head; tail++) {
+            const struct ksort_sample *s =
+                &samples[tail & (KSORT_RING_ENTRIES - 1)];
+
+            if (s->algo >= KSORT_BENCH_SORTS)
+                continue;
+            if (pending && s->algo <= last)
+                stream_row(line, disturbed);
+            line[s->algo] = s->ns;
+            disturbed[s->algo] = !!(s->flags & KSORT_SAMPLE_DISTURBED);
+            last = s->algo;
+            pending = 1;
+        }
+        __atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+    }
+    if (pending)
+        stream_row(line, disturbed);
+
+    ioctl(fd, KSORT_IOC_STREAM_STOP);
+    munmap(map, KSORT_RING_SIZE);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t buf[2 * KSORT_BENCH_SORTS] = {0};
+    uint64_t times[EXPERIMENT][KSORT_BENCH_SORTS] = {0};
+    int disturbed[EXPERIMENT][KSORT_BENCH_SORTS] = {0};
 
     int fd = open(XORO_DEV, O_RDWR);
     if (fd < 0) {
         perror("Failed to open character device");
         exit(1);
     }
+    if (argc > 1 && !strcmp(argv[1], "sweep")) {
+        int ret = sweep(fd);
+        close(fd);
+        return ret;
+    }
+    if (argc > 1 && !strcmp(argv[1], "async")) {
+        int ret = async_mode(fd);
+        close(fd);
+        return ret;
+    }
+    if (argc > 1 && !strcmp(argv[1], "select")) {
+        int ret = select_mode(fd);
+        close(fd);
+        return ret;
+    }
+    if (argc > 1 && !strcmp(argv[1], "cpus")) {
+        int ret = cpus(fd);
+        close(fd);
+        return ret;
+    }
+    if (argc > 1 && !strcmp(argv[1], "stream")) {
+        uint64_t rounds = argc > 2 ? strtoull(argv[2], NULL, 0) : EXPERIMENT;
+        int ret = stream(fd, rounds);
+
+        close(fd);
+        return ret;
+    }
     for (int e = 0; e < EXPERIMENT; ++e) {
         for (int t = 0; t < TEST_TIME; ++t) {
             read(fd, &buf, sizeof(buf));
-            for (int i = 0; i < 17; i++) {
+            for (int i = 0; i < KSORT_BENCH_SORTS; i++) {
                 times[e][i] += buf[i];
+                disturbed[e][i] |=
+                    !!(buf[KSORT_BENCH_SORTS + i] & KSORT_SAMPLE_DISTURBED);
             }
         }
-        for (int i = 0; i < 17; ++i)
+        for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
             times[e][i] /= TEST_TIME;
     }
+    print_names(NULL);
     for (int e = 0; e < EXPERIMENT; ++e) {
-        for (int i = 0; i < 17; ++i) {
+        for (int i = 0; i < KSORT_BENCH_SORTS; ++i) {
             printf("%lu ", times[e][i]);
         }
+        for (int i = 0; i < KSORT_BENCH_SORTS; ++i)
+            printf("%d ", disturbed[e][i]);
         printf("\n");
     }
 
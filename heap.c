@@ -13,6 +13,9 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 
 #include <linux/export.h>
+#include <linux/prefetch.h>
+#include <linux/sched.h>
+#include <linux/string.h>
 #include <linux/types.h>
 
 #include "sort_impl.h"
@@ -134,7 +137,10 @@ static void swap_bytes(void *a, void *b, size_t n)
  * The function pointer is last to make tail calls most efficient if the
  * compiler decides not to inline this function.
  */
-static void do_swap(void *a, void *b, size_t size, swap_func_t swap_func)
+__always_inline static void do_swap(void *a,
+                                    void *b,
+                                    size_t size,
+                                    swap_func_t swap_func)
 {
     if (swap_func == SWAP_WORDS_64)
         swap_words_64(a, b, size);
@@ -186,7 +192,183 @@ __attribute_const__ __always_inline static size_t parent(size_t i,
 }
 
 /**
- * sort_r - sort an array of elements
+ * choose_swap - pick the built-in swap for @base and @size
+ * @base: pointer to data
+ * @size: size of each element
+ * @swap_func: pointer to swap function or NULL
+ *
+ * Returns @swap_func if one was given, the widest word swap that the
+ * alignment allows otherwise.
+ */
+static swap_func_t choose_swap(const void *base,
+                               size_t size,
+                               swap_func_t swap_func)
+{
+    if (swap_func)
+        return swap_func;
+    if (is_aligned(base, size, 8))
+        return SWAP_WORDS_64;
+    if (is_aligned(base, size, 4))
+        return SWAP_WORDS_32;
+    return SWAP_BYTES;
+}
+
+/**
+ * sift_down - sift the element at offset @a down into the heap [0, @n)
+ * @base: pointer to data
+ * @a: byte offset of the element to sift
+ * @n: byte size of the heap
+ * @size: size of each element
+ * @lsbit: "size & -size", see parent()
+ * @cmp_func: pointer to comparison function
+ * @swap_func: pointer to swap function
+ * @priv: third argument passed to comparison function
+ *
+ * This is the "bottom-up" variant, which significantly reduces calls to
+ * cmp_func(): we find the sift-down path all the way to the leaves (one
+ * compare per level), then backtrack to find where to insert the target
+ * element.
+ *
+ * Because elements tend to sift down close to the leaves, this uses fewer
+ * compares than doing two per level on the way down.  (A bit more than half
+ * as many on average, 3/4 worst-case.)
+ */
+__always_inline static void sift_down(char *base,
+                                      size_t a,
+                                      size_t n,
+                                      size_t size,
+                                      unsigned int lsbit,
+                                      cmp_r_func_t cmp_func,
+                                      swap_func_t swap_func,
+                                      const void *priv)
+{
+    size_t b, c, d;
+
+    for (b = a; c = 2 * b + size, (d = c + size) < n;)
+        b = do_cmp(base + c, base + d, cmp_func, priv) >= 0 ? c : d;
+    if (d == n) /* Special case last leaf with no sibling */
+        b = c;
+
+    /* Now backtrack from "b" to the correct location for "a" */
+    while (b != a && do_cmp(base + a, base + b, cmp_func, priv) >= 0)
+        b = parent(b, lsbit, size);
+    c = b;           /* Where "a" belongs */
+    while (b != a) { /* Shift it into place */
+        b = parent(b, lsbit, size);
+        do_swap(base + b, base + c, size, swap_func);
+    }
+}
+
+/*
+ * The 4-ary heap of sort_quad() is laid out so that the children of element
+ * i > 0 are 4i .. 4i + 3 and those of the root 1 .. 3.  Every group of
+ * siblings then starts at a multiple of four elements and spans as few
+ * cache lines as the element size allows, the parent of i is simply i / 4,
+ * and the grandchildren of an element, the children of its sibling group,
+ * are the next 16 elements from there on, which can be prefetched while the
+ * children are compared.  Four-way fan-out halves the levels, and so the
+ * cache misses, of a sift-down through a heap that exceeds the cache.
+ */
+#define HEAP_SHIFT 2
+#define HEAP_ARITY (1 << HEAP_SHIFT)
+
+/**
+ * sift_down_quad - sift element @a down into the 4-ary heap [0, @n)
+ * @base: pointer to data
+ * @a: index of the element to sift
+ * @n: number of elements in the heap
+ * @size: size of each element
+ * @cmp_func: pointer to comparison function
+ * @swap_func: pointer to swap function
+ * @priv: third argument passed to comparison function
+ *
+ * The bottom-up scheme of sift_down(), on element indexes: walk the path of
+ * greatest children down to a leaf, back up to where element @a belongs,
+ * and rotate it in.  The grandchildren are prefetched, one line per sibling
+ * group, before the children are compared.
+ */
+__always_inline static void sift_down_quad(char *base,
+                                           size_t a,
+                                           size_t n,
+                                           size_t size,
+                                           cmp_r_func_t cmp_func,
+                                           swap_func_t swap_func,
+                                           const void *priv)
+{
+    size_t b, c, d, end, g;
+
+    for (b = a;; b = d) {
+        c = b << HEAP_SHIFT;
+        end = c + HEAP_ARITY;
+        if (!c) /* The root has no child 0 */
+            c = 1;
+        if (c >= n)
+            break;
+        if (end > n)
+            end = n;
+
+        for (g = c << HEAP_SHIFT; g < n && g < end << HEAP_SHIFT;
+             g += HEAP_ARITY)
+            prefetch(base + g * size);
+
+        for (d = c++; c < end; c++)
+            d = do_cmp(base + d * size, base + c * size, cmp_func, priv) >= 0
+                    ? d
+                    : c;
+    }
+
+    /* Now backtrack from "b" to the correct location for "a" */
+    while (b != a &&
+           do_cmp(base + a * size, base + b * size, cmp_func, priv) >= 0)
+        b >>= HEAP_SHIFT;
+    c = b;           /* Where "a" belongs */
+    while (b != a) { /* Shift it into place */
+        b >>= HEAP_SHIFT;
+        do_swap(base + b * size, base + c * size, size, swap_func);
+    }
+}
+
+/**
+ * sort_quad - heapsort through the 4-ary heap
+ * @base: pointer to data to sort
+ * @num: number of elements, at least 2
+ * @size: size of each element
+ * @cmp_func: pointer to comparison function
+ * @swap_func: pointer to swap function
+ * @priv: third argument passed to comparison function
+ *
+ * Each level costs three compares instead of one, so this only pays once
+ * the binary heap's extra levels are cache misses; see __sort_r().
+ */
+__always_inline static void sort_quad(char *base,
+                                      size_t num,
+                                      size_t size,
+                                      cmp_r_func_t cmp_func,
+                                      swap_func_t swap_func,
+                                      const void *priv)
+{
+    /* num - 1 is the last element with a parent; build from that parent */
+    size_t n = num, a = ((num - 1) >> HEAP_SHIFT) + 1;
+    unsigned int budget = KSORT_CHECKPOINT_MIN;
+
+    for (;;) {
+        if (a) /* Building heap: sift down --a */
+            a--;
+        else if (--n) /* Sorting: Extract root to --n */
+            do_swap(base, base + n * size, size, swap_func);
+        else /* Sort complete */
+            break;
+
+        if (unlikely(!--budget)) {
+            budget = KSORT_CHECKPOINT_MIN;
+            ksort_checkpoint();
+        }
+        sift_down_quad(base, a, n, size, cmp_func, swap_func, priv);
+    }
+}
+
+/**
+ * __sort_r - sort an array of elements
  * @base: pointer to data to sort
  * @num: number of elements
  * @size: size of each element
@@ -203,13 +385,20 @@ __attribute_const__ __always_inline static size_t parent(size_t i,
  * quicksort is slightly faster on average, it suffers from exploitable
  * O(n*n) worst-case behavior and extra memory requirements that make
  * it less suitable for kernel use.
+ *
+ * Arrays of at least KSORT_HEAP_QUAD_MIN_BYTES go through a 4-ary heap
+ * instead, which takes half as many cache misses per sift-down.  Either
+ * way, and whatever the element size, the sort needs O(1) extra memory, no
+ * recursion and no allocation, so it never sleeps; large elements are not
+ * handed to ksort_indirect() as in sort_intro().  In cooperative mode there
+ * is a checkpoint every KSORT_CHECKPOINT_MIN sift-downs.
  */
-static void sort_r(void *_base,
-                   size_t num,
-                   size_t size,
-                   cmp_r_func_t cmp_func,
-                   swap_func_t swap_func,
-                   const void *priv)
+__always_inline static void __sort_r(void *_base,
+                                     size_t num,
+                                     size_t size,
+                                     cmp_r_func_t cmp_func,
+                                     swap_func_t swap_func,
+                                     const void *priv)
 {
     char *base = _base;
 
@@ -217,18 +406,15 @@ static void sort_r(void *_base,
     size_t n = num * size, a = (num / 2) * size;
     const unsigned int lsbit =
         size & (-(signed) size); /* Used to find parent */
+    unsigned int budget = KSORT_CHECKPOINT_MIN; /* sift-downs per checkpoint */
 
     if (!a) /* num < 2 || size == 0 */
         return;
 
-    if (!swap_func) {
-        if (is_aligned(base, size, 8))
-            swap_func = SWAP_WORDS_64;
-        else if (is_aligned(base, size, 4))
-            swap_func = SWAP_WORDS_32;
-        else
-            swap_func = SWAP_BYTES;
-    }
+    swap_func = choose_swap(base, size, swap_func);
+
+    if (n >= KSORT_HEAP_QUAD_MIN_BYTES)
+        return sort_quad(base, num, size, cmp_func, swap_func, priv);
 
     /*
      * Loop invariants:
@@ -238,8 +424,6 @@ static void sort_r(void *_base,
      * 3. a <= b <= c <= d <= n (whenever they are valid).
      */
     for (;;) {
-        size_t b, c, d;
-
         if (a) /* Building heap: sift down --a */
             a -= size;
         else if (n -= size) /* Sorting: Extract root to --n */
@@ -247,31 +431,58 @@ static void sort_r(void *_base,
         else /* Sort complete */
             break;
 
-        /*
-         * Sift element at "a" down into heap.  This is the
-         * "bottom-up" variant, which significantly reduces
-         * calls to cmp_func(): we find the sift-down path all
-         * the way to the leaves (one compare per level), then
-         * backtrack to find where to insert the target element.
-         *
-         * Because elements tend to sift down close to the leaves,
-         * this uses fewer compares than doing two per level
-         * on the way down.  (A bit more than half as many on
-         * average, 3/4 worst-case.)
-         */
-        for (b = a; c = 2 * b + size, (d = c + size) < n;)
-            b = do_cmp(base + c, base + d, cmp_func, priv) >= 0 ? c : d;
-        if (d == n) /* Special case last leaf with no sibling */
-            b = c;
-
-        /* Now backtrack from "b" to the correct location for "a" */
-        while (b != a && do_cmp(base + a, base + b, cmp_func, priv) >= 0)
-            b = parent(b, lsbit, size);
-        c = b;           /* Where "a" belongs */
-        while (b != a) { /* Shift it into place */
-            b = parent(b, lsbit, size);
-            do_swap(base + b, base + c, size, swap_func);
+        if (unlikely(!--budget)) {
+            budget = KSORT_CHECKPOINT_MIN;
+            ksort_checkpoint();
         }
+        sift_down(base, a, n, size, lsbit, cmp_func, swap_func, priv);
+    }
+}
+
+typedef void (*sort_r_t)(void *base,
+                         size_t num,
+                         size_t size,
+                         cmp_r_func_t cmp_func,
+                         swap_func_t swap_func,
+                         const void *priv);
+
+/*
+ * Copies of __sort_r() with a constant element size, which turns parent()
+ * and the swaps into a few fixed instructions; see ksort_specialize.
+ */
+#define SORT_R(name, elem_size)                                    \
+    static void name(void *base, size_t num, size_t size,          \
+                     cmp_r_func_t cmp_func, swap_func_t swap_func, \
+                     const void *priv)                             \
+    {                                                              \
+        __sort_r(base, num, elem_size, cmp_func, swap_func, priv); \
+    }
+
+SORT_R(sort_r, size)
+SORT_R(sort_r_4, 4)
+SORT_R(sort_r_8, 8)
+SORT_R(sort_r_12, 12)
+SORT_R(sort_r_16, 16)
+SORT_R(sort_r_32, 32)
+
+static sort_r_t choose_sort_r(size_t size)
+{
+    if (!ksort_specialize)
+        return sort_r;
+
+    switch (size) {
+    case 4:
+        return sort_r_4;
+    case 8:
+        return sort_r_8;
+    case 12:
+        return sort_r_12;
+    case 16:
+        return sort_r_16;
+    case 32:
+        return sort_r_32;
+    default:
+        return sort_r;
     }
 }
 
@@ -281,5 +492,137 @@ void sort_heap(void *base,
                cmp_func_t cmp_func,
                swap_func_t swap_func)
 {
-    return sort_r(base, num, size, _CMP_WRAPPER, swap_func, cmp_func);
+    return choose_sort_r(size)(base, num, size, _CMP_WRAPPER, swap_func,
+                               cmp_func);
+}
+
+void sort_heap_r(void *base,
+                 size_t num,
+                 size_t size,
+                 cmp_r_func_t cmp_func,
+                 swap_func_t swap_func,
+                 const void *priv)
+{
+    return choose_sort_r(size)(base, num, size, cmp_func, swap_func, priv);
+}
+
+/**
+ * ksort_topk - move the @k smallest elements to the front, sorted
+ * @base: pointer to data
+ * @num: number of elements
+ * @size: size of each element
+ * @k: number of elements to keep
+ * @cmp_func: pointer to comparison function
+ * @swap_func: pointer to swap function or NULL
+ *
+ * [0, @k) is kept as a max-heap of the smallest elements seen so far, and
+ * every later element smaller than its root replaces it.  This takes
+ * O(n log k) time and no extra memory; the order of [@k, @num) is unspecified
+ * afterwards.
+ */
+void ksort_topk(void *_base,
+                size_t num,
+                size_t size,
+                size_t k,
+                cmp_func_t cmp_func,
+                swap_func_t swap_func)
+{
+    char *base = _base;
+    const unsigned int lsbit = size & (-(signed) size);
+    size_t n, a, i;
+
+    if (k > num)
+        k = num;
+    if (!k || !size)
+        return;
+
+    swap_func = choose_swap(base, size, swap_func);
+    n = k * size;
+
+    for (a = (k / 2) * size; a;) {
+        a -= size;
+        sift_down(base, a, n, size, lsbit, _CMP_WRAPPER, swap_func, cmp_func);
+    }
+
+    for (i = n; i < num * size; i += size) {
+        if (do_cmp(base + i, base, _CMP_WRAPPER, cmp_func) < 0) {
+            do_swap(base, base + i, size, swap_func);
+            sift_down(base, 0, n, size, lsbit, _CMP_WRAPPER, swap_func,
+                      cmp_func);
+        }
+    }
+
+    while (n -= size) {
+        do_swap(base, base + n, size, swap_func);
+        sift_down(base, 0, n, size, lsbit, _CMP_WRAPPER, swap_func, cmp_func);
+    }
+}
+
+/**
+ * ksort_topk_init - start a bounded top-k selection over a stream
+ * @t: selection state
+ * @heap: room for @k elements of @size bytes
+ * @k: number of elements to keep
+ * @size: size of each element
+ * @cmp_func: pointer to comparison function
+ * @swap_func: pointer to swap function or NULL
+ */
+void ksort_topk_init(struct ksort_topk *t,
+                     void *heap,
+                     size_t k,
+                     size_t size,
+                     cmp_func_t cmp_func,
+                     swap_func_t swap_func)
+{
+    t->heap = heap;
+    t->k = k;
+    t->size = size;
+    t->n = 0;
+    t->cmp_func = cmp_func;
+    t->swap_func = choose_swap(heap, size, swap_func);
+}
+
+/**
+ * ksort_topk_push - offer one element of the stream
+ * @t: selection state
+ * @elem: element to offer, copied into the heap if it is kept
+ */
+void ksort_topk_push(struct ksort_topk *t, const void *elem)
+{
+    const size_t size = t->size;
+    const unsigned int lsbit = size & (-(signed) size);
+    char *heap = t->heap;
+
+    if (!t->k)
+        return;
+
+    if (t->n < t->k) { /* Still filling: sift the new leaf up */
+        size_t c = t->n++ * size;
+
+        memcpy(heap + c, elem, size);
+        while (c) {
+            size_t b = parent(c, lsbit, size);
+
+            if (do_cmp(heap + b, heap + c, _CMP_WRAPPER, t->cmp_func) >= 0)
+                break;
+            do_swap(heap + b, heap + c, size, t->swap_func);
+            c = b;
+        }
+    } else if (do_cmp(elem, heap, _CMP_WRAPPER, t->cmp_func) < 0) {
+        memcpy(heap, elem, size);
+        sift_down(heap, 0, t->n * size, size, lsbit, _CMP_WRAPPER,
+                  t->swap_func, t->cmp_func);
+    }
+}
+
+/**
+ * ksort_topk_finish - sort the kept elements
+ * @t: selection state
+ *
+ * Returns the number of elements kept, which are sorted in the heap buffer.
+ */
+size_t ksort_topk_finish(struct ksort_topk *t)
+{
+    sort_r(t->heap, t->n, t->size, _CMP_WRAPPER, t->swap_func, t->cmp_func);
+    return t->n;
 }
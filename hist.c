@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Latency histograms of the asynchronous sorts, in debugfs
+ *
+ * Every completed sort of the asynchronous queue is counted in a histogram
+ * of its algorithm and size bucket.  The histograms are log-linear, like
+ * HdrHistogram: each power of two is split into HIST_SUB equal buckets, so a
+ * value is known to within 1/HIST_SUB of itself whatever its magnitude.
+ * The counters are per CPU, which makes recording two this_cpu operations;
+ * readers add up the CPUs.
+ *
+ * /sys/kernel/debug/ksort/ holds:
+ *   latency  count, mean, p50, p90, p99, p999 and max of every histogram
+ *            that is not empty, in nanoseconds
+ *   buckets  the nonzero buckets of every histogram, as value ranges
+ *   reset    writing anything zeroes all the histograms
+ *
+ * A percentile is reported as the highest value of the bucket it falls in,
+ * so it is never below the true one.  Reading while sorts complete gives a
+ * slightly inconsistent view, and so does a reset, which is not atomic
+ * against concurrent recording.
+ */
+
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/errno.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+#include "hist.h"
+#include "ksort.h"
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 /* about 18 minutes; longer sorts count as that */
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+#define HIST_ALGOS (KSORT_ALGO_MERGE + 1)
+#define HIST_SIZES 6 /* by element count: < 16, < 256, ... < 2^20, more */
+
+struct hist {
+    u64 counts[HIST_BUCKETS];
+    u64 sum;
+};
+
+static const char *const hist_algos[HIST_ALGOS] = {
+    [KSORT_ALGO_HEAP] = "heap",
+    [KSORT_ALGO_INTRO] = "intro",
+    [KSORT_ALGO_PDQSORT] = "pdqsort",
+    [KSORT_ALGO_INDIRECT] = "indirect",
+    [KSORT_ALGO_MERGE] = "merge",
+};
+
+static struct hist __percpu *hists[HIST_ALGOS][HIST_SIZES];
+struct dentry *ksort_debugfs;
+
+static unsigned int hist_size(size_t num)
+{
+    return num ? min(ilog2(num) / 4, HIST_SIZES - 1) : 0;
+}
+
+/* Bucket of a value: values below HIST_SUB have one each, and every later
+ * power of two is split into HIST_SUB buckets */
+static unsigned int hist_bucket(u64 v)
+{
+    unsigned int e;
+
+    if (v >= 1ULL << HIST_MAX_BITS)
+        v = (1ULL << HIST_MAX_BITS) - 1;
+    if (v < HIST_SUB)
+        return v;
+    e = fls64(v) - 1 - HIST_SUB_BITS;
+    return (e + 1) * HIST_SUB + (v >> e) - HIST_SUB;
+}
+
+/* Lowest value of a bucket; HIST_BUCKETS gives 1 << HIST_MAX_BITS */
+static u64 hist_lowest(unsigned int b)
+{
+    if (b < HIST_SUB)
+        return b;
+    return (u64) (HIST_SUB + b % HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+static u64 hist_highest(unsigned int b)
+{
+    return hist_lowest(b + 1) - 1;
+}
+
+/**
+ * ksort_hist_record - count a completed sort
+ * @algo: KSORT_ALGO_* of the sort
+ * @num: number of elements
+ * @ns: time the sort took
+ */
+void ksort_hist_record(unsigned int algo, size_t num, u64 ns)
+{
+    struct hist __percpu *h;
+
+    if (algo >= HIST_ALGOS)
+        return;
+    h = hists[algo][hist_size(num)];
+    this_cpu_inc(h->counts[hist_bucket(ns)]);
+    this_cpu_add(h->sum, ns);
+}
+
+/* Add up the CPUs of a histogram into @sum; returns the number of values */
+static u64 hist_collect(struct hist __percpu *h, struct hist *sum)
+{
+    u64 total = 0;
+    unsigned int b;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu (cpu) {
+        const struct hist *c = per_cpu_ptr(h, cpu);
+
+        for (b = 0; b < HIST_BUCKETS; b++)
+            sum->counts[b] += c->counts[b];
+        sum->sum += c->sum;
+    }
+    for (b = 0; b < HIST_BUCKETS; b++)
+        total += sum->counts[b];
+    return total;
+}
+
+/* Value at a rank of @permille thousandths of @total */
+static u64 hist_percentile(const struct hist *sum, u64 total, u64 permille)
+{
+    const u64 rank = max_t(u64, DIV_ROUND_UP_ULL(total * permille, 1000), 1);
+    u64 seen = 0;
+    unsigned int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += sum->counts[b];
+        if (seen >= rank)
+            return hist_highest(b);
+    }
+    return hist_highest(HIST_BUCKETS - 1);
+}
+
+static void hist_show_size(struct seq_file *m, unsigned int s)
+{
+    if (s == HIST_SIZES - 1)
+        seq_printf(m, "%lu-", 1UL << (4 * s));
+    else
+        seq_printf(m, "%lu-%lu", s ? 1UL << (4 * s) : 0,
+                   (1UL << (4 * (s + 1))) - 1);
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+    struct hist *sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    unsigned int a, s, b;
+
+    if (!sum)
+        return -ENOMEM;
+
+    seq_puts(m, "# algo elements count mean p50 p90 p99 p999 max\n");
+    for (a = 0; a < HIST_ALGOS; a++) {
+        for (s = 0; s < HIST_SIZES; s++) {
+            const u64 total = hist_collect(hists[a][s], sum);
+
+            if (!total)
+                continue;
+            for (b = HIST_BUCKETS - 1; !sum->counts[b]; b--)
+                ;
+            seq_printf(m, "%s ", hist_algos[a]);
+            hist_show_size(m, s);
+            seq_printf(m, " %llu %llu %llu %llu %llu %llu %llu\n", total,
+                       div64_u64(sum->sum, total),
+                       hist_percentile(sum, total, 500),
+                       hist_percentile(sum, total, 900),
+                       hist_percentile(sum, total, 990),
+                       hist_percentile(sum, total, 999), hist_highest(b));
+        }
+    }
+
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+static int buckets_show(struct seq_file *m, void *v)
+{
+    struct hist *sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+    unsigned int a, s, b;
+
+    if (!sum)
+        return -ENOMEM;
+
+    seq_puts(m, "# algo elements lowest highest count\n");
+    for (a = 0; a < HIST_ALGOS; a++) {
+        for (s = 0; s < HIST_SIZES; s++) {
+            if (!hist_collect(hists[a][s], sum))
+                continue;
+            for (b = 0; b < HIST_BUCKETS; b++) {
+                if (!sum->counts[b])
+                    continue;
+                seq_printf(m, "%s ", hist_algos[a]);
+                hist_show_size(m, s);
+                seq_printf(m, " %llu %llu %llu\n", hist_lowest(b),
+                           hist_highest(b), sum->counts[b]);
+            }
+        }
+    }
+
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(buckets);
+
+static ssize_t reset_write(struct file *file,
+                           const char __user *buf,
+                           size_t count,
+                           loff_t *ppos)
+{
+    unsigned int a, s;
+    int cpu;
+
+    for (a = 0; a < HIST_ALGOS; a++)
+        for (s = 0; s < HIST_SIZES; s++)
+            for_each_possible_cpu (cpu)
+                memset(per_cpu_ptr(hists[a][s], cpu), 0,
+                       sizeof(struct hist));
+    return count;
+}
+
+static const struct file_operations reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = reset_write,
+    .llseek = noop_llseek,
+};
+
+/**
+ * ksort_hist_init - allocate the histograms and create the debugfs files
+ *
+ * The histograms work without debugfs, so failing to create the files is
+ * not an error.
+ *
+ * Returns 0, or -ENOMEM.
+ */
+int ksort_hist_init(void)
+{
+    unsigned int a, s;
+
+    for (a = 0; a < HIST_ALGOS; a++) {
+        for (s = 0; s < HIST_SIZES; s++) {
+            hists[a][s] = alloc_percpu(struct hist);
+            if (!hists[a][s]) {
+                ksort_hist_exit();
+                return -ENOMEM;
+            }
+        }
+    }
+
+    ksort_debugfs = debugfs_create_dir("ksort", NULL);
+    debugfs_create_file("latency", 0444, ksort_debugfs, NULL, &latency_fops);
+    debugfs_create_file("buckets", 0444, ksort_debugfs, NULL, &buckets_fops);
+    debugfs_create_file("reset", 0200, ksort_debugfs, NULL, &reset_fops);
+    return 0;
+}
+
+void ksort_hist_exit(void)
+{
+    unsigned int a, s;
+
+    debugfs_remove_recursive(ksort_debugfs);
+    ksort_debugfs = NULL;
+    for (a = 0; a < HIST_ALGOS; a++) {
+        for (s = 0; s < HIST_SIZES; s++) {
+            free_percpu(hists[a][s]);
+            hists[a][s] = NULL;
+        }
+    }
+}
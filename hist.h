@@ -0,0 +1,19 @@
+#ifndef KSORT_HIST_H
+#define KSORT_HIST_H
+
+/*
+ * Per-CPU latency histograms of the asynchronous sorts, exported in debugfs,
+ * see hist.c.
+ */
+extern int ksort_hist_init(void);
+extern void ksort_hist_exit(void);
+
+extern void ksort_hist_record(unsigned int algo, size_t num, u64 ns);
+
+struct dentry;
+
+/* The ksort/ directory in debugfs, between ksort_hist_init() and
+ * ksort_hist_exit(); other parts of the module add their files to it */
+extern struct dentry *ksort_debugfs;
+
+#endif
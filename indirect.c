@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Indirect (argsort) sorting for large elements
+ *
+ * The void* engines move every element with do_swap() each time they swap
+ * two of them, so the memory traffic grows with the element size.  Here the
+ * elements are sorted through an array of small entries instead, each
+ * holding an element index and optionally a cached key prefix, and the
+ * resulting permutation is applied in place at the end with cycle-leader
+ * moves: every element is copied exactly once, plus one copy per cycle
+ * through a temporary.
+ */
+
+#include <linux/errno.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "ksort_trace.h"
+#include "sort_impl.h"
+
+static inline int __log2(size_t x)
+{
+    return 63 - __builtin_clzll(x);
+}
+
+struct indirect_entry {
+    u64 prefix;
+    size_t index;
+};
+
+struct indirect_ctx {
+    const char *base;
+    size_t size;
+    cmp_func_t cmp_func;
+    bool less; /* cmp_func is a "less than" predicate */
+};
+
+/**
+ * cmp_entry - compare the elements behind two entries
+ * @a: pointer to the first entry
+ * @b: pointer to the second entry
+ * @priv: the struct indirect_ctx of this sort
+ *
+ * Cached prefixes decide whenever they differ; only equal prefixes reach
+ * cmp_func.  Without a prefix function every prefix is 0.
+ */
+static int cmp_entry(const void *a, const void *b, const void *priv)
+{
+    const struct indirect_entry *x = a, *y = b;
+    const struct indirect_ctx *ctx = priv;
+    const char *ea, *eb;
+
+    if (x->prefix != y->prefix)
+        return x->prefix < y->prefix ? -1 : 1;
+
+    ea = ctx->base + x->index * ctx->size;
+    eb = ctx->base + y->index * ctx->size;
+    if (!ctx->less)
+        return ctx->cmp_func(ea, eb);
+    if (ctx->cmp_func(ea, eb))
+        return -1;
+    return ctx->cmp_func(eb, ea);
+}
+
+static inline void swap_entry(struct indirect_entry *a,
+                              struct indirect_entry *b)
+{
+    struct indirect_entry t = *a;
+
+    *a = *b;
+    *b = t;
+}
+
+/**
+ * sort_entries - introsort the entry array
+ * @ent: entries to sort
+ * @num: number of entries
+ * @ctx: the struct indirect_ctx of this sort
+ * @depth: partitions left before falling back to heapsort
+ *
+ * A quicksort with median-of-three pivots that recurses into the smaller
+ * side and loops on the larger one, insertion sort for short ranges, and
+ * sort_heap_r() once @depth runs out.  Entries are small and the comparison
+ * is inlined, so this is what makes the indirect mode pay off.
+ */
+static void sort_entries(struct indirect_entry *ent,
+                         size_t num,
+                         const struct indirect_ctx *ctx,
+                         int depth)
+{
+    while (num > 16) {
+        struct indirect_entry *lo = ent, *hi = ent + num - 1;
+        struct indirect_entry *mid = ent + num / 2, pivot;
+
+        if (num >= KSORT_CHECKPOINT_MIN)
+            ksort_checkpoint();
+
+        if (depth-- == 0) {
+            trace_ksort_heap_fallback(KSORT_ALGO_INDIRECT, num);
+            sort_heap_r(ent, num, sizeof(*ent), cmp_entry, NULL, ctx);
+            return;
+        }
+
+        if (cmp_entry(mid, lo, ctx) < 0)
+            swap_entry(mid, lo);
+        if (cmp_entry(hi, mid, ctx) < 0) {
+            swap_entry(hi, mid);
+            if (cmp_entry(mid, lo, ctx) < 0)
+                swap_entry(mid, lo);
+        }
+        pivot = *mid;
+
+        /* Hoare partition; lo and hi already bound both scans */
+        for (;;) {
+            while (cmp_entry(++lo, &pivot, ctx) < 0)
+                ;
+            while (cmp_entry(&pivot, --hi, ctx) < 0)
+                ;
+            if (lo >= hi)
+                break;
+            swap_entry(lo, hi);
+        }
+        trace_ksort_partition(KSORT_ALGO_INDIRECT, num, hi + 1 - ent);
+
+        if (hi + 1 - ent < ent + num - (hi + 1)) {
+            sort_entries(ent, hi + 1 - ent, ctx, depth);
+            num -= hi + 1 - ent;
+            ent = hi + 1;
+        } else {
+            sort_entries(hi + 1, ent + num - (hi + 1), ctx, depth);
+            num = hi + 1 - ent;
+        }
+    }
+
+    for (size_t i = 1; i < num; i++) {
+        struct indirect_entry t = ent[i];
+        size_t j = i;
+
+        for (; j > 0 && cmp_entry(&t, &ent[j - 1], ctx) < 0; j--)
+            ent[j] = ent[j - 1];
+        ent[j] = t;
+    }
+}
+
+/**
+ * apply_permutation - move the elements into sorted order
+ * @base: pointer to data
+ * @size: size of each element
+ * @ent: entries, ent[i].index being the element that belongs at i
+ * @num: number of elements
+ * @tmp: room for one element
+ *
+ * Each cycle of the permutation is rotated through @tmp: its first element
+ * is saved, every other element is copied straight to its final slot, and
+ * the saved one goes last.  Placed slots are marked by pointing their entry
+ * at themselves.  Cooperative mode checkpoints once per KSORT_CHECKPOINT_MIN
+ * slots scanned, between cycles.
+ */
+static void apply_permutation(char *base,
+                              size_t size,
+                              struct indirect_entry *ent,
+                              size_t num,
+                              char *tmp)
+{
+    size_t i, j, k;
+
+    for (i = 0; i < num; i++) {
+        if (!(i & (KSORT_CHECKPOINT_MIN - 1)))
+            ksort_checkpoint();
+        if (ent[i].index == i)
+            continue;
+
+        memcpy(tmp, base + i * size, size);
+        for (j = i; (k = ent[j].index) != i; j = k) {
+            memcpy(base + j * size, base + k * size, size);
+            ent[j].index = j;
+        }
+        memcpy(base + j * size, tmp, size);
+        ent[j].index = j;
+    }
+}
+
+static int __ksort_indirect(void *base,
+                            size_t num,
+                            size_t size,
+                            cmp_func_t cmp_func,
+                            bool less,
+                            prefix_func_t prefix_func)
+{
+    struct indirect_ctx ctx = {
+        .base = base,
+        .size = size,
+        .cmp_func = cmp_func,
+        .less = less,
+    };
+    struct indirect_entry *ent;
+    char *tmp;
+    size_t i;
+
+    if (num < 2)
+        return 0;
+
+    ent = kmalloc_array(num, sizeof(*ent), GFP_KERNEL);
+    tmp = kmalloc(size, GFP_KERNEL);
+    if (!ent || !tmp) {
+        kfree(ent);
+        kfree(tmp);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < num; i++) {
+        ent[i].prefix = prefix_func ? prefix_func(ctx.base + i * size) : 0;
+        ent[i].index = i;
+    }
+
+    sort_entries(ent, num, &ctx, __log2(num) << 1);
+    apply_permutation(base, size, ent, num, tmp);
+
+    kfree(tmp);
+    kfree(ent);
+    return 0;
+}
+
+/**
+ * ksort_indirect - sort large elements through an index array
+ * @base: pointer to data to sort
+ * @num: number of elements
+ * @size: size of each element
+ * @cmp_func: three-way comparison function, as for sort_heap()
+ * @prefix_func: key prefix function or NULL
+ *
+ * If given, @prefix_func maps an element to a u64 whose order agrees with
+ * @cmp_func: a smaller prefix must mean a smaller element, and only elements
+ * with equal prefixes are passed to @cmp_func.  Most compares then never
+ * touch the elements at all.
+ *
+ * The elements are moved with memcpy(), so this only suits elements that
+ * the built-in swaps could move as well.  The sort is not stable.
+ *
+ * Returns 0, or -ENOMEM if the index array can't be allocated, in which
+ * case @base is left untouched.
+ */
+int ksort_indirect(void *base,
+                   size_t num,
+                   size_t size,
+                   cmp_func_t cmp_func,
+                   prefix_func_t prefix_func)
+{
+    return __ksort_indirect(base, num, size, cmp_func, false, prefix_func);
+}
+
+/**
+ * ksort_indirect_less - ksort_indirect() for a "less than" predicate
+ * @base: pointer to data to sort
+ * @num: number of elements
+ * @size: size of each element
+ * @cmp_func: "less than" predicate, as for sort_pdqsort()
+ * @prefix_func: key prefix function or NULL
+ */
+int ksort_indirect_less(void *base,
+                        size_t num,
+                        size_t size,
+                        cmp_func_t cmp_func,
+                        prefix_func_t prefix_func)
+{
+    return __ksort_indirect(base, num, size, cmp_func, true, prefix_func);
+}
@@ -5,10 +5,16 @@
  * - Binary heapsort with Floyd's optimization, for stack depth > 2log2(n)
  * - Final shellsort pass on skipped small partitions (small gaps only)
  */
+#include <linux/compiler.h>
 #include <linux/limits.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timex.h>
 #include <linux/types.h>
 
+#include "ksort_trace.h"
+#include "profile.h"
 #include "sort_impl.h"
 
 typedef int (*cmp_func_t)(const void *, const void *);
@@ -25,6 +31,29 @@ static inline int __log2(size_t x)
     return 63 - __builtin_clzll(x);
 }
 
+/**
+ * is_aligned - is this pointer & size okay for word-wide copying?
+ * @base: pointer to data
+ * @size: size of each element
+ * @align: required alignment (typically 4 or 8)
+ *
+ * Returns true if elements can be copied using word loads and stores.
+ * The size must be a multiple of the alignment, and the base address must
+ * be if we do not have CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS.
+ */
+__attribute_const__ __always_inline static bool is_aligned(const void *base,
+                                                           size_t size,
+                                                           unsigned char align)
+{
+    unsigned char lsbits = (unsigned char) size;
+
+    (void) base;
+#ifndef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+    lsbits |= (unsigned char) (uintptr_t) base;
+#endif
+    return (lsbits & (align - 1)) == 0;
+}
+
 /**
  * swap_words_32 - swap two elements in 32-bit chunks
  * @a: pointer to the first element to swap
@@ -115,39 +144,58 @@ static void swap_bytes(void *a, void *b, size_t n)
 /*
  * The function pointer is last to make tail calls most efficient if the
  * compiler decides not to inline this function.
+ *
+ * The sorting code passes 0 (SWAP_WORDS_64) for the built-in swap, so that
+ * case falls back to narrower chunks when the element size or the addresses
+ * don't allow 64-bit ones.
  */
-static void do_swap(void *a, void *b, size_t size, swap_func_t swap_func)
+__always_inline static void do_swap(void *a,
+                                    void *b,
+                                    size_t size,
+                                    swap_func_t swap_func)
 {
-    if (swap_func == SWAP_WORDS_64)
-        swap_words_64(a, b, size);
-    else if (swap_func == SWAP_WORDS_32)
+    if (swap_func == SWAP_WORDS_64) {
+        const void *ab = (const void *) ((uintptr_t) a | (uintptr_t) b);
+
+        if (is_aligned(ab, size, 8))
+            swap_words_64(a, b, size);
+        else if (is_aligned(ab, size, 4))
+            swap_words_32(a, b, size);
+        else
+            swap_bytes(a, b, size);
+    } else if (swap_func == SWAP_WORDS_32) {
         swap_words_32(a, b, size);
-    else if (swap_func == SWAP_BYTES)
+    } else if (swap_func == SWAP_BYTES) {
         swap_bytes(a, b, size);
-    else
+    } else {
         swap_func(a, b, (int) size);
+    }
 }
 
-void sort_intro(void *base,
-                size_t num,
-                size_t size,
-                cmp_func_t cmp_func,
-                swap_func_t swap_func)
+/*
+ * The sort itself, instantiated below once per specialized element size so
+ * that @size is a constant in each copy.
+ */
+__always_inline static void __sort_intro(char *array,
+                                         size_t num,
+                                         size_t size,
+                                         cmp_func_t cmp_func)
 {
-    if (num == 0)
-        return;
-
-    char *array = (char *) base;
-    const size_t max_thresh = size << 4;
+    const size_t thresh = READ_ONCE(ksort_intro_threshold);
+    const size_t max_thresh = size * thresh;
     const int max_depth = __log2(num) << 1;
 
     /* Temporary storage used by both heapsort and shellsort */
+    ksort_profile_begin(KSORT_PHASE_ALLOC);
     char *tmp = kmalloc(size, GFP_KERNEL);
+    ksort_profile_end(KSORT_PHASE_ALLOC);
 
-    if (num > 16) {
+    if (num > thresh) {
         char *low = array, *high = array + idx(num - 1);
+        ksort_profile_begin(KSORT_PHASE_ALLOC);
         stack_node_t *stack =
             kmalloc_array(STACK_SIZE, sizeof(*stack), GFP_KERNEL);
+        ksort_profile_end(KSORT_PHASE_ALLOC);
         stack_node_t *top = stack + 1;
 
         int depth = 0;
@@ -155,6 +203,10 @@ void sort_intro(void *base,
             /* Exceeded max depth: do heapsort on this partition */
             if (depth > max_depth) {
                 size_t part_length = (size_t)((high - low) / size) - 1;
+
+                trace_ksort_heap_fallback(KSORT_ALGO_INTRO,
+                                          (high - low) / size + 1);
+                ksort_profile_begin(KSORT_PHASE_HEAP);
                 if (part_length > 0) {
                     size_t i, j, k = part_length >> 1;
 
@@ -210,6 +262,7 @@ void sort_intro(void *base,
                         memcpy(low + idx(i), tmp, size);
                     } while (part_length-- > 0);
                 }
+                ksort_profile_end(KSORT_PHASE_HEAP);
 
                 /* pop next partition from stack */
                 --top;
@@ -219,8 +272,12 @@ void sort_intro(void *base,
                 continue;
             }
 
+            if ((size_t)(high - low) >= idx(KSORT_CHECKPOINT_MIN))
+                ksort_checkpoint();
+
             /* 3-way "Dutch national flag" partition */
             char *mid = low + size * ((high - low) / size >> 1);
+            ksort_profile_begin(KSORT_PHASE_PIVOT);
             if (cmp_func(mid, low) < 0)
                 do_swap(mid, low, size, 0);
             if (cmp_func(mid, high) > 0)
@@ -231,9 +288,11 @@ void sort_intro(void *base,
                 do_swap(mid, low, size, 0);
 
         skip:;
+            ksort_profile_end(KSORT_PHASE_PIVOT);
             char *left = low + size, *right = high - size;
 
             /* sort this partition */
+            ksort_profile_begin(KSORT_PHASE_PARTITION);
             do {
                 while (cmp_func(left, mid) < 0)
                     left += size;
@@ -252,6 +311,10 @@ void sort_intro(void *base,
                     break;
                 }
             } while (left <= right);
+            ksort_profile_end(KSORT_PHASE_PARTITION);
+
+            trace_ksort_partition(KSORT_ALGO_INTRO, (high - low) / size + 1,
+                                  (right + size - low) / size);
 
             /* Prepare the next iteration
              * Push larger partition and sort the other; unless one or both
@@ -298,10 +361,8 @@ void sort_intro(void *base,
     const size_t gaps[2] = {1ul, 4ul};
 
     int i = 0;
+    ksort_profile_begin(KSORT_PHASE_SMALL);
     do {
-        if (num < 4)
-            continue;
-
         for (size_t j = gaps[i], k = j; j < num; k = ++j) {
             // memcpy(tmp, array + idx(k), size);
 
@@ -315,5 +376,62 @@ void sort_intro(void *base,
             // memcpy(array + idx(k), tmp, size);
         }
     } while (i-- > 0);
+    ksort_profile_end(KSORT_PHASE_SMALL);
     kfree(tmp);
+}
+
+typedef void (*sort_intro_t)(char *array,
+                             size_t num,
+                             size_t size,
+                             cmp_func_t cmp_func);
+
+#define SORT_INTRO(name, elem_size)                        \
+    static void name(char *array, size_t num, size_t size, \
+                     cmp_func_t cmp_func)                  \
+    {                                                      \
+        __sort_intro(array, num, elem_size, cmp_func);     \
+    }
+
+SORT_INTRO(sort_intro_any, size)
+SORT_INTRO(sort_intro_4, 4)
+SORT_INTRO(sort_intro_8, 8)
+SORT_INTRO(sort_intro_12, 12)
+SORT_INTRO(sort_intro_16, 16)
+SORT_INTRO(sort_intro_32, 32)
+
+static sort_intro_t choose_sort(size_t size)
+{
+    if (!ksort_specialize)
+        return sort_intro_any;
+
+    switch (size) {
+    case 4:
+        return sort_intro_4;
+    case 8:
+        return sort_intro_8;
+    case 12:
+        return sort_intro_12;
+    case 16:
+        return sort_intro_16;
+    case 32:
+        return sort_intro_32;
+    default:
+        return sort_intro_any;
+    }
+}
+
+void sort_intro(void *base,
+                size_t num,
+                size_t size,
+                cmp_func_t cmp_func,
+                swap_func_t swap_func)
+{
+    if (num == 0)
+        return;
+
+    if (!swap_func && size >= KSORT_INDIRECT_MIN_SIZE &&
+        !ksort_indirect(base, num, size, cmp_func, NULL))
+        return;
+
+    choose_sort(size)(base, num, size, cmp_func);
 }
\ No newline at end of file
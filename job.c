@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Time-sliced, resumable sort jobs
+ *
+ * A job sorts one array in steps: each ksort_job_run() call does work until
+ * its time budget is spent and returns, and the next call carries on where
+ * it stopped.  The sort is a bottom-up merge sort, whose whole state is a
+ * handful of cursors into the array, so a job can stop between any two
+ * element moves.  A partitioning sort would have to make its partition scans
+ * and its heapsort fallback resumable as well to give the same bound on the
+ * pause.  The merge sort is also stable and has no bad inputs, so the total
+ * work is known in advance: about n*log2(n) element moves.
+ */
+
+#include <linux/errno.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/types.h>
+
+#include "sort_impl.h"
+
+/* Leaf runs are insertion sorted before the merge passes */
+#define JOB_RUN 16
+
+enum {
+    JOB_LEAVES, /* insertion sorting the run at lo */
+    JOB_MERGE,  /* merging the runs at lo of the width pass */
+    JOB_DONE,
+};
+
+/* Prepare the merge of the pair of runs at job->lo of the current pass */
+static void job_start_merge(struct ksort_job *job)
+{
+    job->i = job->lo;
+    job->mid = min(job->lo + job->width, job->num);
+    job->j = job->mid;
+    job->hi = min(job->lo + 2 * job->width, job->num);
+}
+
+/* Move on to the next pair of runs, or to the next pass */
+static void job_next_merge(struct ksort_job *job)
+{
+    char *t;
+
+    job->lo = job->hi;
+    if (job->lo >= job->num) {
+        t = job->src;
+        job->src = job->dst;
+        job->dst = t;
+        job->width *= 2;
+        job->lo = 0;
+        if (job->width >= job->num) {
+            job->state = JOB_DONE;
+            return;
+        }
+    }
+    job_start_merge(job);
+}
+
+/* Insertion sort the leaf run at job->lo, with job->buf as the spare slot */
+static void job_sort_leaf(struct ksort_job *job)
+{
+    const size_t size = job->size;
+    char *run = job->base + job->lo * size;
+    const size_t n = min(job->run, job->num - job->lo);
+    size_t i, j;
+
+    for (i = 1; i < n; i++) {
+        for (j = i; j > 0; j--)
+            if (job->cmp_func(run + (j - 1) * size, run + i * size) <= 0)
+                break;
+        if (j == i)
+            continue;
+
+        memcpy(job->buf, run + i * size, size);
+        memmove(run + (j + 1) * size, run + j * size, (i - j) * size);
+        memcpy(run + j * size, job->buf, size);
+    }
+}
+
+/**
+ * job_step - do a bounded amount of sorting
+ * @job: the job
+ * @work: number of element moves to do, counting a leaf run as JOB_RUN
+ *
+ * Returns true once the array is sorted.
+ */
+static bool job_step(struct ksort_job *job, size_t work)
+{
+    const size_t size = job->size;
+
+    while (job->state == JOB_LEAVES) {
+        if (job->lo >= job->num) {
+            job->lo = 0;
+            job->state = JOB_MERGE;
+            if (job->width >= job->num) {
+                job->state = JOB_DONE;
+                return true;
+            }
+            job_start_merge(job);
+            break;
+        }
+        if (work < job->run)
+            return false;
+        job_sort_leaf(job);
+        job->lo += job->run;
+        work -= job->run;
+    }
+
+    while (job->state == JOB_MERGE && work) {
+        const char *src = job->src;
+        char *dst = job->dst;
+
+        /* Ties go to the left run, which keeps the sort stable */
+        for (; work && job->i < job->mid && job->j < job->hi; work--) {
+            size_t *from = &job->i;
+
+            if (job->cmp_func(src + job->j * size, src + job->i * size) < 0)
+                from = &job->j;
+            memcpy(dst + (job->i + job->j - job->mid) * size,
+                   src + *from * size, size);
+            ++*from;
+        }
+
+        /* One run is exhausted: copy up to work elements of the other */
+        if (job->i == job->mid || job->j == job->hi) {
+            size_t *from = job->i < job->mid ? &job->i : &job->j;
+            const size_t end = job->i < job->mid ? job->mid : job->hi;
+            const size_t n = min(work, end - *from);
+
+            memcpy(dst + (job->i + job->j - job->mid) * size,
+                   src + *from * size, n * size);
+            *from += n;
+            work -= n;
+            if (*from == end)
+                job_next_merge(job);
+        }
+    }
+
+    return job->state == JOB_DONE;
+}
+
+/**
+ * ksort_job_init - prepare a resumable sort of an array
+ * @job: job to initialize
+ * @base: pointer to data to sort
+ * @num: number of elements
+ * @size: size of each element
+ * @cmp_func: three-way comparison function, as for sort_heap()
+ *
+ * The job needs a scratch buffer as large as the array, allocated here.
+ * Nothing is sorted until ksort_job_run() is called, and @base must not be
+ * touched by anyone else until the job is done.
+ *
+ * Returns 0, or -ENOMEM if the buffer can't be allocated.
+ */
+int ksort_job_init(struct ksort_job *job,
+                   void *base,
+                   size_t num,
+                   size_t size,
+                   cmp_func_t cmp_func)
+{
+    size_t width;
+    int passes = 0;
+
+    memset(job, 0, sizeof(*job));
+    job->base = base;
+    job->num = num;
+    job->size = size;
+    job->cmp_func = cmp_func;
+    job->run = JOB_RUN;
+
+    /* Make the number of passes even so that the result lands in @base */
+    for (width = job->run; width < num; width *= 2)
+        passes++;
+    if ((passes & 1) && job->run > 1)
+        job->run = (job->run + 1) / 2;
+
+    job->buf = kvmalloc_array(max_t(size_t, num, 1), size, GFP_KERNEL);
+    if (!job->buf)
+        return -ENOMEM;
+
+    job->src = base;
+    job->dst = job->buf;
+    job->width = job->run;
+    job->state = JOB_LEAVES;
+    return 0;
+}
+
+/**
+ * ksort_job_run - advance a sort job for up to a time budget
+ * @job: job from ksort_job_init()
+ * @budget_ns: time to spend, in nanoseconds
+ *
+ * The clock is read every KSORT_JOB_STRIDE element moves, so the call
+ * overruns @budget_ns by at most that much work.  At least one stride is
+ * done per call, so a job always makes progress.
+ *
+ * Returns 0 once the array is sorted, or -EAGAIN if there is work left.
+ */
+int ksort_job_run(struct ksort_job *job, u64 budget_ns)
+{
+    const u64 deadline = ktime_get_ns() + budget_ns;
+
+    do {
+        if (job_step(job, KSORT_JOB_STRIDE))
+            return 0;
+    } while (ktime_get_ns() < deadline);
+
+    return -EAGAIN;
+}
+
+/**
+ * ksort_job_destroy - release the resources of a job
+ * @job: job from ksort_job_init(), finished or not
+ *
+ * An unfinished job leaves @base permuted but not sorted.
+ */
+void ksort_job_destroy(struct ksort_job *job)
+{
+    kvfree(job->buf);
+    job->buf = NULL;
+}
@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of /dev/xoroshiro128p beyond read(): the asynchronous
+ * sort queue and the benchmark sample stream.
+ *
+ * Sorts are submitted in batches of struct ksort_sqe with KSORT_IOC_SUBMIT
+ * and run on a kernel workqueue, several at a time.  Each one posts a
+ * struct ksort_cqe to the completion ring of the open file, which
+ * KSORT_IOC_REAP empties.  poll() reports EPOLLIN while completions are
+ * waiting, and an eventfd registered with KSORT_IOC_SET_EVENTFD is
+ * signalled once per completion.
+ *
+ * The array of a sort is sorted in place.  Its pages are pinned from
+ * submission to completion, and it must not be touched in between.
+ */
+#ifndef KSORT_UAPI_H
+#define KSORT_UAPI_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Sorting engines, see sort_impl.h */
+#define KSORT_ALGO_HEAP 0     /* sort_heap() */
+#define KSORT_ALGO_INTRO 1    /* sort_intro() */
+#define KSORT_ALGO_PDQSORT 2  /* sort_pdqsort() */
+#define KSORT_ALGO_INDIRECT 3 /* ksort_indirect() with the key as prefix */
+#define KSORT_ALGO_MERGE 4    /* stable, time-sliced ksort_job */
+
+/* Key of each element: an unsigned integer at offset 0, native endian */
+#define KSORT_KEY_U32 0
+#define KSORT_KEY_U64 1
+
+/* Completions that can be outstanding, submitted but not reaped */
+#define KSORT_CQ_ENTRIES 256
+
+/*
+ * Longest array of the engines other than KSORT_ALGO_MERGE, which run
+ * without a rescheduling point unless the module is loaded with
+ * cooperative=1; longer ones fail with -E2BIG.  KSORT_ALGO_MERGE takes any
+ * length.
+ */
+#define KSORT_ASYNC_MAX_NUM (1 << 20)
+
+struct ksort_sqe {
+    __u64 user_data; /* returned as is in the completion */
+    __u64 addr;      /* array to sort */
+    __u64 num;       /* number of elements */
+    __u32 size;      /* size of each element, at least the key size */
+    __u16 algo;      /* KSORT_ALGO_* */
+    __u16 key;       /* KSORT_KEY_* */
+};
+
+struct ksort_cqe {
+    __u64 user_data;
+    __s32 res; /* 0 or a negative errno */
+    __u32 pad;
+    __u64 ns; /* time spent sorting */
+};
+
+struct ksort_submit {
+    __u64 sqes; /* array of struct ksort_sqe */
+    __u32 nr;
+    __u32 pad;
+};
+
+struct ksort_reap {
+    __u64 cqes; /* room for nr struct ksort_cqe */
+    __u32 nr;
+    __u32 pad;
+};
+
+/*
+ * Sorts of the benchmark.  read() returns the time of each in ns, in this
+ * order, then its KSORT_SAMPLE_* flags; the sample stream numbers them 0 to
+ * KSORT_BENCH_SORTS - 1 in the algo of a struct ksort_sample.
+ */
+#define KSORT_BENCH_SORTS 26
+
+/*
+ * Benchmark sample stream.  KSORT_IOC_STREAM_START runs the benchmark of
+ * read() for the given number of rounds in a kernel thread, which pushes one
+ * struct ksort_sample per sort into a single-producer, single-consumer ring
+ * that userspace maps with mmap() at offset 0.  The mapping holds a struct
+ * ksort_ring_hdr, followed at KSORT_RING_SAMPLES by the KSORT_RING_ENTRIES
+ * samples.  Sample i is in slot i % KSORT_RING_ENTRIES.
+ *
+ * The kernel stores head after writing the sample before it, and userspace
+ * stores tail after reading the sample before it, both with release
+ * semantics; each side loads the other's index with acquire semantics.
+ * The kernel waits while the ring is full.  done is set after the last
+ * sample, or when the stream is stopped.
+ */
+struct ksort_sample {
+    __u32 algo; /* column of the sort in the results of read() */
+    __u32 dist; /* bench_dist of the input */
+    __u64 num;  /* number of elements */
+    __u64 ns;
+    __u64 cycles;   /* get_cycles() difference */
+    __u32 irqs;     /* hard interrupts taken by the CPU during the sort */
+    __u32 softirqs; /* softirqs run by the CPU during the sort */
+    __u32 csw;      /* context switches of the benchmark thread */
+    __u32 flags;    /* KSORT_SAMPLE_* */
+};
+
+/* Something else ran during the sort: irqs, softirqs or csw is nonzero, or
+ * the thread migrated.  Such a sample measures more than the sort. */
+#define KSORT_SAMPLE_DISTURBED (1 << 0)
+/* The thread changed CPUs, so irqs and softirqs are unknown and left 0 */
+#define KSORT_SAMPLE_MIGRATED (1 << 1)
+
+struct ksort_ring_hdr {
+    __u32 head; /* samples pushed, written by the kernel */
+    __u32 done;
+    __u8 pad0[56];
+    __u32 tail; /* samples consumed, written by userspace */
+    __u8 pad1[60];
+};
+
+#define KSORT_RING_ENTRIES (1 << 16)
+#define KSORT_RING_SAMPLES 4096
+#define KSORT_RING_SIZE \
+    (KSORT_RING_SAMPLES + KSORT_RING_ENTRIES * sizeof(struct ksort_sample))
+
+struct ksort_stream {
+    __u64 rounds; /* times to run every sort */
+    __u32 len;    /* elements per sort, 0 for bench_len */
+    __u32 pad;
+};
+
+#define KSORT_IOC_MAGIC 'k'
+
+/*
+ * KSORT_IOC_SUBMIT returns the number of sqes queued, which is less than nr
+ * when the completion ring would overflow or an sqe is invalid; it fails
+ * only if the first sqe can't be queued.  KSORT_IOC_REAP returns the number
+ * of cqes copied out and never blocks.  KSORT_IOC_SET_EVENTFD takes an
+ * eventfd, or -1 to unregister it.
+ */
+#define KSORT_IOC_SUBMIT _IOW(KSORT_IOC_MAGIC, 1, struct ksort_submit)
+#define KSORT_IOC_REAP _IOW(KSORT_IOC_MAGIC, 2, struct ksort_reap)
+#define KSORT_IOC_SET_EVENTFD _IOW(KSORT_IOC_MAGIC, 3, int)
+
+/*
+ * KSORT_IOC_STREAM_START fails with -EBUSY while an earlier stream has not
+ * been stopped with KSORT_IOC_STREAM_STOP, which is also what reaps a
+ * finished stream.  Starting a stream empties the ring.
+ */
+#define KSORT_IOC_STREAM_START _IOW(KSORT_IOC_MAGIC, 4, struct ksort_stream)
+#define KSORT_IOC_STREAM_STOP _IO(KSORT_IOC_MAGIC, 5)
+
+#endif
@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints of the sorting engines, under events/ksort/ in tracefs.
+ *
+ * They mark the steps that decide how long a sort takes: where each
+ * partition split its range, when pdqsort meets a bad partition and
+ * shuffles, when intro or pdqsort give up on partitioning and heapsort a
+ * range, and the runs, merges and buffers of the sort.h sorts.  Disabled
+ * tracepoints cost a patched-out branch; the arguments are values the
+ * engines compute anyway.
+ *
+ * main.c defines the tracepoints; the engines only include this header.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ksort
+
+#if !defined(KSORT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define KSORT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "ksort.h"
+
+#define show_ksort_algo(algo)                                            \
+    __print_symbolic(algo, {KSORT_ALGO_HEAP, "heap"},                    \
+                     {KSORT_ALGO_INTRO, "intro"},                        \
+                     {KSORT_ALGO_PDQSORT, "pdqsort"},                    \
+                     {KSORT_ALGO_INDIRECT, "indirect"},                  \
+                     {KSORT_ALGO_MERGE, "merge"})
+
+/* A range of num elements was partitioned with rank elements before the
+ * pivot, or before the split point of a three-way partition */
+TRACE_EVENT(ksort_partition,
+
+            TP_PROTO(unsigned int algo, size_t num, size_t rank),
+
+            TP_ARGS(algo, num, rank),
+
+            TP_STRUCT__entry(__field(unsigned int, algo)
+                                 __field(size_t, num) __field(size_t, rank)),
+
+            TP_fast_assign(__entry->algo = algo; __entry->num = num;
+                           __entry->rank = rank;),
+
+            TP_printk("algo=%s num=%zu rank=%zu",
+                      show_ksort_algo(__entry->algo), __entry->num,
+                      __entry->rank));
+
+/* pdqsort found a partition with a side under num / 8 and swapped elements
+ * of both sides around to break the pattern */
+TRACE_EVENT(ksort_pdq_shuffle,
+
+            TP_PROTO(size_t num, size_t l_size, size_t r_size),
+
+            TP_ARGS(num, l_size, r_size),
+
+            TP_STRUCT__entry(__field(size_t, num) __field(size_t, l_size)
+                                 __field(size_t, r_size)),
+
+            TP_fast_assign(__entry->num = num; __entry->l_size = l_size;
+                           __entry->r_size = r_size;),
+
+            TP_printk("num=%zu l_size=%zu r_size=%zu", __entry->num,
+                      __entry->l_size, __entry->r_size));
+
+/* A partitioning sort ran out of depth, or of stack memory, and heapsorts a
+ * range of num elements instead */
+TRACE_EVENT(ksort_heap_fallback,
+
+            TP_PROTO(unsigned int algo, size_t num),
+
+            TP_ARGS(algo, num),
+
+            TP_STRUCT__entry(__field(unsigned int, algo)
+                                 __field(size_t, num)),
+
+            TP_fast_assign(__entry->algo = algo; __entry->num = num;),
+
+            TP_printk("algo=%s num=%zu", show_ksort_algo(__entry->algo),
+                      __entry->num));
+
+/* Tim sort or power sort pushed the run [start, start + len) */
+TRACE_EVENT(ksort_tim_push,
+
+            TP_PROTO(size_t start, size_t len),
+
+            TP_ARGS(start, len),
+
+            TP_STRUCT__entry(__field(size_t, start) __field(size_t, len)),
+
+            TP_fast_assign(__entry->start = start; __entry->len = len;),
+
+            TP_printk("start=%zu len=%zu", __entry->start, __entry->len));
+
+/* Tim sort or power sort merges the runs of a and b elements at start */
+TRACE_EVENT(ksort_tim_merge,
+
+            TP_PROTO(size_t start, size_t a, size_t b),
+
+            TP_ARGS(start, a, b),
+
+            TP_STRUCT__entry(__field(size_t, start) __field(size_t, a)
+                                 __field(size_t, b)),
+
+            TP_fast_assign(__entry->start = start; __entry->a = a;
+                           __entry->b = b;),
+
+            TP_printk("start=%zu a=%zu b=%zu", __entry->start, __entry->a,
+                      __entry->b));
+
+/* SORT_NEW_BUFFER allocated room for num elements of size bytes */
+TRACE_EVENT(ksort_new_buffer,
+
+            TP_PROTO(size_t num, size_t size, const void *buf),
+
+            TP_ARGS(num, size, buf),
+
+            TP_STRUCT__entry(__field(size_t, num) __field(size_t, size)
+                                 __field(bool, failed)),
+
+            TP_fast_assign(__entry->num = num; __entry->size = size;
+                           __entry->failed = !buf;),
+
+            TP_printk("num=%zu bytes=%zu%s", __entry->num,
+                      __entry->num * __entry->size,
+                      __entry->failed ? " failed" : ""));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ksort_trace
+#include <trace/define_trace.h>
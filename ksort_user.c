@@ -0,0 +1,829 @@
+/* Userspace benchmark of the sorting engines
+ *
+ * Built by "make ksort_user" from the same heap.c, intro.c, pdqsort.c,
+ * indirect.c, sort.h and xoroshiro128plus.c as the module, against the
+ * kernel API stand-ins in shim/.  No module, root or kernel tree is needed,
+ * so the engines can run under perf, valgrind and the sanitizers, e.g.
+ *
+ *   make ksort_user USER_CFLAGS="-O1 -g -fsanitize=address,undefined"
+ *
+ * Every sort runs on the same input as in the module benchmark, a copy of
+ * the PRNG output seeded with pi and phi unless -S says otherwise, and is
+ * checked afterwards; the exit status is 1 if any result is out of order.
+ * The void* engines also sort elements of other sizes than 8 bytes (-e),
+ * with the key at offset 0 and the rest zeroed, as in the element-size sweep
+ * of main.c.  -R prints every sample instead of the summary, for bench.py.
+ *
+ * -t checks the APIs that are not full sorts instead: selection, partial
+ * sort and top-k, against qsort() of libc on edge and middle ranks, and the
+ * stable k-way merge on empty runs and runs of equal keys.  It also runs the
+ * merge-based sorts on 32-bit keys, for the vector merge of sort.h when
+ * built with -msse4.1, and every sort of -l on the same sizes, the void*
+ * engines with small and large elements as well.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/compiler.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+
+#include "sort_impl.h"
+
+#define SORT_NAME ksort
+#define SORT_TYPE uint64_t
+#define SORT_SIMD_MERGE 64
+#define SORT_RADIX_KEY(x) (x)
+#define SORT_PAYLOAD_TYPE uint32_t
+#define SORT_CHECKPOINT() ksort_checkpoint()
+#define SORT_CHECKPOINT_MIN KSORT_CHECKPOINT_MIN
+#include "sort.h"
+
+/* The k-way merge checks of -t compare only the upper half of an element,
+ * and tag the lower half with the run and position it came from, so that a
+ * stable merge is the same as a full sort by value. */
+#define SORT_NAME ksort_tagged
+#define SORT_TYPE uint64_t
+#define SORT_CMP(x, y) \
+    ((x) >> 32 < (y) >> 32 ? -1 : ((y) >> 32 < (x) >> 32 ? 1 : 0))
+#include "sort.h"
+
+/* 32-bit keys, so that -t runs the u32 vector merge of MERGE_TWO in a build
+ * with SSE4.1 as well as the u64 one with AVX2, see "make check_user" */
+#define SORT_NAME ksort32
+#define SORT_TYPE uint32_t
+#define SORT_SIMD_MERGE 32
+#include "sort.h"
+
+extern void seed(uint64_t, uint64_t);
+extern uint64_t next(void);
+
+/* The engine settings main.c exports as module parameters, at their
+ * defaults */
+bool ksort_specialize = true;
+bool ksort_cooperative;
+unsigned int ksort_pdq_insertion_threshold = 24;
+unsigned int ksort_pdq_ninther_threshold = 128;
+unsigned int ksort_pdq_partial_insertion_limit = 8;
+unsigned int ksort_intro_threshold = 16;
+
+#define DIST_RANDOM 0
+#define DIST_RUNS 1 /* ascending runs of random length, as seen by tim sort */
+
+static int cmpint64(const void *a, const void *b)
+{
+    uint64_t a_val = *(uint64_t *) a;
+    uint64_t b_val = *(uint64_t *) b;
+    if (a_val > b_val)
+        return 1;
+    if (a_val == b_val)
+        return 0;
+    return -1;
+}
+
+static int cmpuint64(const void *a, const void *b)
+{
+    return *(uint64_t *) a < *(uint64_t *) b;
+}
+
+/* Keys of the elements of -e bytes: u32 for 4, u64 from 8 on */
+static int cmp_key32(const void *a, const void *b)
+{
+    u32 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_key32(const void *a, const void *b)
+{
+    return cmp_key32(a, b) < 0;
+}
+
+static u64 prefix_key32(const void *a)
+{
+    u32 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+static int cmp_key64(const void *a, const void *b)
+{
+    u64 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_key64(const void *a, const void *b)
+{
+    return cmp_key64(a, b) < 0;
+}
+
+static u64 prefix_key64(const void *a)
+{
+    u64 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+/* Same as fill_dist() of main.c */
+static void fill_dist(uint64_t *arr, size_t n, unsigned int dist)
+{
+    size_t i = 0;
+
+    if (dist != DIST_RUNS) {
+        for (; i < n; ++i)
+            arr[i] = next();
+        return;
+    }
+
+    while (i < n) {
+        size_t run = 1 + next() % 128;
+        uint64_t val = next() >> 8;
+
+        for (; run && i < n; --run, ++i)
+            arr[i] = val += next() >> 40;
+    }
+}
+
+typedef void (*bench_sort_t)(uint64_t *arr, uint32_t *vals, size_t n);
+
+#define BENCH_SORT(name)                                              \
+    static void bench_##name(uint64_t *arr, uint32_t *vals, size_t n) \
+    {                                                                 \
+        ksort_##name(arr, n);                                         \
+    }
+#define BENCH_KV_SORT(name)                                           \
+    static void bench_##name(uint64_t *arr, uint32_t *vals, size_t n) \
+    {                                                                 \
+        ksort_##name(arr, vals, n);                                   \
+    }
+
+/* The void* engines, on n elements of size bytes */
+typedef void (*bench_elem_sort_t)(void *base, size_t n, size_t size);
+
+static void bench_kernel_heap_sort(void *base, size_t n, size_t size)
+{
+    sort_heap(base, n, size, size == 8 ? cmpint64 : cmp_key64, NULL);
+}
+
+static void bench_intro_sort(void *base, size_t n, size_t size)
+{
+    sort_intro(base, n, size, size == 8 ? cmpint64 : cmp_key64, NULL);
+}
+
+static void bench_pdqsort(void *base, size_t n, size_t size)
+{
+    sort_pdqsort(base, n, size, size == 8 ? cmpuint64 : less_key64, NULL);
+}
+
+static void bench_indirect(void *base, size_t n, size_t size)
+{
+    ksort_indirect(base, n, size, cmp_key64, prefix_key64);
+}
+
+/* The same with 4-byte elements and u32 keys */
+static void bench_kernel_heap_sort32(void *base, size_t n, size_t size)
+{
+    sort_heap(base, n, size, cmp_key32, NULL);
+}
+
+static void bench_intro_sort32(void *base, size_t n, size_t size)
+{
+    sort_intro(base, n, size, cmp_key32, NULL);
+}
+
+static void bench_pdqsort32(void *base, size_t n, size_t size)
+{
+    sort_pdqsort(base, n, size, less_key32, NULL);
+}
+
+static void bench_indirect32(void *base, size_t n, size_t size)
+{
+    ksort_indirect(base, n, size, cmp_key32, prefix_key32);
+}
+
+BENCH_SORT(merge_sort)
+BENCH_SORT(shell_sort)
+BENCH_SORT(binary_insertion_sort)
+BENCH_SORT(heap_sort)
+BENCH_SORT(quick_sort)
+BENCH_SORT(selection_sort)
+BENCH_SORT(tim_sort)
+BENCH_SORT(bubble_sort)
+BENCH_SORT(bitonic_sort)
+BENCH_SORT(merge_sort_in_place)
+BENCH_SORT(grail_sort)
+BENCH_SORT(sqrt_sort)
+BENCH_SORT(rec_stable_sort)
+BENCH_SORT(grail_sort_dyn_buffer)
+BENCH_SORT(power_sort)
+BENCH_SORT(merge_sort_bottom_up)
+BENCH_SORT(radix_sort)
+BENCH_SORT(auto)
+BENCH_KV_SORT(kv_quick_sort)
+BENCH_KV_SORT(kv_merge_sort)
+BENCH_KV_SORT(kv_radix_sort)
+BENCH_SORT(weak_heap_sort)
+BENCH_SORT(smooth_sort)
+
+#undef BENCH_SORT
+#undef BENCH_KV_SORT
+
+/* The quadratic sorts are skipped above this many elements unless named
+ * with -s */
+#define SLOW_SORT_MAX 20000
+
+/* A sort of uint64_t keys, or a void* engine with its sort of 4-byte
+ * elements */
+struct bench_sort {
+    const char *name;
+    bench_sort_t sort;
+    bench_elem_sort_t elem_sort, elem_sort32;
+    bool slow;
+    bool kv; /* sorts vals along with the keys */
+};
+
+#define ELEM_SORT(name, sort) {name, NULL, bench_##sort, bench_##sort##32}
+
+/* In the column order of the module benchmark, then the engines it only
+ * times in the element-size sweep */
+static const struct bench_sort bench_sorts[] = {
+    ELEM_SORT("kernel_heap", kernel_heap_sort),
+    {"merge", bench_merge_sort},
+    {"shell", bench_shell_sort},
+    {"binary_insertion", bench_binary_insertion_sort, .slow = true},
+    {"heap", bench_heap_sort},
+    {"quick", bench_quick_sort},
+    {"selection", bench_selection_sort, .slow = true},
+    {"tim", bench_tim_sort},
+    {"bubble", bench_bubble_sort, .slow = true},
+    {"bitonic", bench_bitonic_sort, .slow = true},
+    {"merge_in_place", bench_merge_sort_in_place},
+    {"grail", bench_grail_sort},
+    {"sqrt", bench_sqrt_sort},
+    {"rec_stable", bench_rec_stable_sort},
+    {"grail_dyn_buffer", bench_grail_sort_dyn_buffer},
+    ELEM_SORT("intro", intro_sort),
+    ELEM_SORT("pdqsort", pdqsort),
+    {"power", bench_power_sort},
+    {"merge_bottom_up", bench_merge_sort_bottom_up},
+    {"radix", bench_radix_sort},
+    {"auto", bench_auto},
+    {"kv_quick", bench_kv_quick_sort, .kv = true},
+    {"kv_merge", bench_kv_merge_sort, .kv = true},
+    {"kv_radix", bench_kv_radix_sort, .kv = true},
+    {"weak_heap", bench_weak_heap_sort},
+    {"smooth", bench_smooth_sort},
+    ELEM_SORT("indirect", indirect),
+};
+
+#undef ELEM_SORT
+
+/* Largest -e; the element-size sweep of main.c stops at 256 */
+#define ELEM_SIZE_MAX 4096
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+    return cmpint64(a, b);
+}
+
+/* Whether a sort takes elements of size bytes */
+static bool sorts_size(const struct bench_sort *s, size_t size)
+{
+    return s->elem_sort || size == sizeof(uint64_t);
+}
+
+/* Run one sort of a copy of input and put the time it took in *ns; returns
+ * false if the result is out of order */
+static bool run_sort(const struct bench_sort *s,
+                     char *arr,
+                     const char *input,
+                     uint32_t *vals,
+                     size_t n,
+                     size_t size,
+                     uint64_t *ns)
+{
+    const cmp_func_t cmp = size == 4 ? cmp_key32 : cmp_key64;
+    uint64_t start;
+    size_t i;
+
+    memcpy(arr, input, n * size);
+    for (i = 0; i < n; i++)
+        vals[i] = i;
+    start = now_ns();
+    if (!s->elem_sort)
+        s->sort((uint64_t *) arr, vals, n);
+    else if (size == 4)
+        s->elem_sort32(arr, n, size);
+    else
+        s->elem_sort(arr, n, size);
+    *ns = now_ns() - start;
+
+    for (i = 1; i < n && cmp(arr + (i - 1) * size, arr + i * size) <= 0; i++)
+        ;
+    if (i < n) {
+        pr_err("%s: out of order at %zu of %zu\n", s->name, i, n);
+        return false;
+    }
+    return true;
+}
+
+/* Checks of -t.  Each one runs an API on a copy of input and compares the
+ * result with ref, the input sorted by qsort(); tmp is scratch room. */
+#define CHECK_SIZES 9
+#define MERGE_K_RUNS 40
+#define MERGE_K_LEN 120
+static const size_t check_sizes[CHECK_SIZES] = {0,  1,   2,    3,   23,
+                                                24, 100, 1000, 5000};
+
+/* Whether arr holds the same elements as ref */
+static bool same_elements(const uint64_t *arr,
+                          const uint64_t *ref,
+                          uint64_t *tmp,
+                          size_t n)
+{
+    memcpy(tmp, arr, n * sizeof(*tmp));
+    qsort(tmp, n, sizeof(*tmp), cmpint64);
+    return !memcmp(tmp, ref, n * sizeof(*tmp));
+}
+
+static bool check_select(const uint64_t *input,
+                         const uint64_t *ref,
+                         uint64_t *arr,
+                         uint64_t *tmp,
+                         size_t n,
+                         size_t k)
+{
+    size_t i;
+
+    memcpy(arr, input, n * sizeof(*arr));
+    ksort_select(arr, n, sizeof(*arr), k, cmpuint64);
+    if (!same_elements(arr, ref, tmp, n))
+        return false;
+    if (k >= n)
+        return true;
+    if (arr[k] != ref[k])
+        return false;
+    for (i = 0; i < n; i++)
+        if (i < k ? arr[i] > arr[k] : arr[i] < arr[k])
+            return false;
+    return true;
+}
+
+static void partial_sort_u64(uint64_t *arr, size_t n, size_t k)
+{
+    ksort_partial_sort(arr, n, sizeof(*arr), k, cmpuint64, NULL);
+}
+
+static void topk_u64(uint64_t *arr, size_t n, size_t k)
+{
+    ksort_topk(arr, n, sizeof(*arr), k, cmpint64, NULL);
+}
+
+/* The stream top-k, with the kept elements copied back to the front */
+static void topk_stream_u64(uint64_t *arr, size_t n, size_t k)
+{
+    uint64_t *heap = kmalloc_array(k ? k : 1, sizeof(*heap), GFP_KERNEL);
+    struct ksort_topk t;
+    size_t i, kept;
+
+    if (!heap)
+        abort();
+    ksort_topk_init(&t, heap, k, sizeof(*heap), cmpint64, NULL);
+    for (i = 0; i < n; i++)
+        ksort_topk_push(&t, &arr[i]);
+    kept = ksort_topk_finish(&t);
+    if (kept != (k < n ? k : n))
+        memset(arr, 0xff, n * sizeof(*arr)); /* fails the check */
+    else
+        memcpy(arr, heap, kept * sizeof(*arr));
+    kfree(heap);
+}
+
+/* The k smallest elements must end up sorted in [0, k), and in_place APIs
+ * must keep the rest of the elements too */
+static bool check_prefix(void (*api)(uint64_t *arr, size_t n, size_t k),
+                         bool in_place,
+                         const uint64_t *input,
+                         const uint64_t *ref,
+                         uint64_t *arr,
+                         uint64_t *tmp,
+                         size_t n,
+                         size_t k)
+{
+    memcpy(arr, input, n * sizeof(*arr));
+    api(arr, n, k);
+    if (in_place && !same_elements(arr, ref, tmp, n))
+        return false;
+    return !memcmp(arr, ref, (k < n ? k : n) * sizeof(*arr));
+}
+
+/* Sort a copy of input with s and compare with ref; a KV sort must also
+ * carry the index of every key along */
+static bool check_sort(const struct bench_sort *s,
+                       const uint64_t *input,
+                       const uint64_t *ref,
+                       uint64_t *arr,
+                       uint32_t *vals,
+                       size_t n)
+{
+    uint64_t ns;
+    size_t i;
+
+    if (!run_sort(s, (char *) arr, (const char *) input, vals, n,
+                  sizeof(*arr), &ns) ||
+        memcmp(arr, ref, n * sizeof(*arr)))
+        return false;
+    for (i = 0; s->kv && i < n; i++)
+        if (vals[i] >= n || input[vals[i]] != arr[i])
+            return false;
+    return true;
+}
+
+/* Element sizes of the void* engines in -t besides 8: the u32 keys, and
+ * elements below and above KSORT_INDIRECT_MIN_SIZE */
+static const size_t check_elem_sizes[] = {4, 24, 136};
+#define CHECK_ELEM_MAX 136
+
+/* Sort n elements of size bytes with the void* engine of s, keyed by the
+ * u32 keys32 for 4 bytes and by the u64 keys otherwise, the rest zeroed;
+ * ref holds the same keys sorted.  elems and arr hold n elements. */
+static bool check_elem_sort(const struct bench_sort *s,
+                            const void *keys,
+                            const void *ref,
+                            char *elems,
+                            char *arr,
+                            uint32_t *vals,
+                            size_t n,
+                            size_t size)
+{
+    const size_t key_size = size == 4 ? sizeof(u32) : sizeof(u64);
+    uint64_t ns;
+    size_t i;
+
+    memset(elems, 0, n * size);
+    for (i = 0; i < n; i++)
+        memcpy(elems + i * size, (const char *) keys + i * key_size,
+               key_size);
+    if (!run_sort(s, arr, elems, vals, n, size, &ns))
+        return false;
+    for (i = 0; i < n; i++)
+        if (memcmp(arr + i * size, (const char *) ref + i * key_size,
+                   key_size))
+            return false;
+    return true;
+}
+
+/* The sorts of ksort32 that merge with MERGE_TWO */
+static const struct {
+    const char *name;
+    void (*sort)(uint32_t *arr, size_t n);
+} sorts32[] = {
+    {"merge32", ksort32_merge_sort},
+    {"merge_bottom_up32", ksort32_merge_sort_bottom_up},
+    {"tim32", ksort32_tim_sort},
+    {"grail32", ksort32_grail_sort},
+    {"sqrt32", ksort32_sqrt_sort},
+};
+
+/* Merge k tagged runs of random lengths up to max_len, some of them empty,
+ * with keys below key_range, and check the merge is stable */
+static bool check_merge_k(uint64_t *input,
+                          uint64_t *ref,
+                          uint64_t *out,
+                          size_t k,
+                          size_t max_len,
+                          uint64_t key_range)
+{
+    const uint64_t *runs[MERGE_K_RUNS];
+    size_t lens[MERGE_K_RUNS];
+    size_t total = 0, r, i;
+
+    for (r = 0; r < k; r++) {
+        lens[r] = next() % 4 ? next() % (max_len + 1) : 0;
+        runs[r] = &input[total];
+        for (i = 0; i < lens[r]; i++)
+            input[total + i] = next() % key_range << 32;
+        qsort(&input[total], lens[r], sizeof(*input), cmpint64);
+        for (i = 0; i < lens[r]; i++)
+            input[total + i] |= r << 16 | i;
+        total += lens[r];
+    }
+
+    memcpy(ref, input, total * sizeof(*ref));
+    qsort(ref, total, sizeof(*ref), cmpint64);
+    ksort_tagged_merge_k(out, runs, lens, k);
+    return !memcmp(out, ref, total * sizeof(*out));
+}
+
+/* Run the checks on every size of check_sizes, with random input, runs and
+ * many duplicates, for the ranks 0, 1, n / 2, n - 1, n and n + 1 */
+static int run_checks(void)
+{
+    const size_t max = check_sizes[CHECK_SIZES - 1];
+    const uint64_t key_ranges[] = {1, 4, 1ULL << 32};
+    uint64_t *input, *ref, *arr, *tmp;
+    uint32_t *input32, *ref32, *arr32, *vals;
+    char *elems, *elems_arr;
+    unsigned int failed = 0, checks = 0, dist;
+    size_t s, r, i, j, k;
+
+    input = kmalloc_array(max, sizeof(*input), GFP_KERNEL);
+    ref = kmalloc_array(max, sizeof(*ref), GFP_KERNEL);
+    arr = kmalloc_array(max, sizeof(*arr), GFP_KERNEL);
+    tmp = kmalloc_array(max, sizeof(*tmp), GFP_KERNEL);
+    input32 = kmalloc_array(max, sizeof(*input32), GFP_KERNEL);
+    ref32 = kmalloc_array(max, sizeof(*ref32), GFP_KERNEL);
+    arr32 = kmalloc_array(max, sizeof(*arr32), GFP_KERNEL);
+    vals = kmalloc_array(max, sizeof(*vals), GFP_KERNEL);
+    elems = kmalloc_array(max, CHECK_ELEM_MAX, GFP_KERNEL);
+    elems_arr = kmalloc_array(max, CHECK_ELEM_MAX, GFP_KERNEL);
+    if (!input || !ref || !arr || !tmp || !input32 || !ref32 || !arr32 ||
+        !vals || !elems || !elems_arr) {
+        perror("Failed to allocate the checks");
+        return 1;
+    }
+
+    seed(314159265, 1618033989);
+    for (s = 0; s < CHECK_SIZES; s++) {
+        const size_t n = check_sizes[s];
+        const size_t ranks[] = {0, 1, n / 2, n ? n - 1 : 0, n, n + 1};
+
+        for (dist = 0; dist < 3; dist++) {
+            fill_dist(input, n, dist == DIST_RUNS ? DIST_RUNS : DIST_RANDOM);
+            if (dist == 2) /* duplicates */
+                for (i = 0; i < n; i++)
+                    input[i] %= 5;
+            memcpy(ref, input, n * sizeof(*ref));
+            qsort(ref, n, sizeof(*ref), cmpint64);
+
+            for (r = 0; r < ARRAY_SIZE(ranks); r++) {
+                const size_t k = ranks[r];
+                const struct {
+                    const char *name;
+                    bool ok;
+                } results[] = {
+                    {"select",
+                     check_select(input, ref, arr, tmp, n, k)},
+                    {"partial_sort", check_prefix(partial_sort_u64, true,
+                                                  input, ref, arr, tmp, n, k)},
+                    {"topk", check_prefix(topk_u64, true, input, ref, arr,
+                                          tmp, n, k)},
+                    {"topk_stream", check_prefix(topk_stream_u64, false,
+                                                 input, ref, arr, tmp, n, k)},
+                };
+
+                for (i = 0; i < ARRAY_SIZE(results); i++) {
+                    checks++;
+                    if (results[i].ok)
+                        continue;
+                    pr_err("%s failed: n %zu, k %zu, input %u\n",
+                           results[i].name, n, k, dist);
+                    failed++;
+                }
+            }
+
+            /* The upper halves keep the runs, the lower ones the duplicates */
+            for (i = 0; i < n; i++)
+                input32[i] = dist == 2 ? input[i] : input[i] >> 32;
+            memcpy(ref32, input32, n * sizeof(*ref32));
+            qsort(ref32, n, sizeof(*ref32), cmp_key32);
+            for (i = 0; i < ARRAY_SIZE(sorts32); i++) {
+                checks++;
+                memcpy(arr32, input32, n * sizeof(*arr32));
+                sorts32[i].sort(arr32, n);
+                if (!memcmp(arr32, ref32, n * sizeof(*arr32)))
+                    continue;
+                pr_err("%s failed: n %zu, input %u\n", sorts32[i].name, n,
+                       dist);
+                failed++;
+            }
+
+            for (j = 0; j < ARRAY_SIZE(bench_sorts); j++) {
+                const struct bench_sort *b = &bench_sorts[j];
+
+                checks++;
+                if (!check_sort(b, input, ref, arr, vals, n)) {
+                    pr_err("%s failed: n %zu, input %u\n", b->name, n, dist);
+                    failed++;
+                }
+                for (i = 0; b->elem_sort && i < ARRAY_SIZE(check_elem_sizes);
+                     i++) {
+                    const size_t size = check_elem_sizes[i];
+
+                    checks++;
+                    if (check_elem_sort(b, size == 4 ? (void *) input32 : input,
+                                        size == 4 ? (void *) ref32 : ref,
+                                        elems, elems_arr, vals, n, size))
+                        continue;
+                    pr_err("%s failed: n %zu, input %u, %zu bytes\n",
+                           b->name, n, dist, size);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    for (k = 1; k <= MERGE_K_RUNS; k++) {
+        for (r = 0; r < ARRAY_SIZE(key_ranges); r++) {
+            for (i = 0; i < 4; i++) {
+                const size_t max_len = i ? MERGE_K_LEN >> (2 * (i - 1)) : 0;
+
+                checks++;
+                if (check_merge_k(input, ref, arr, k, max_len, key_ranges[r]))
+                    continue;
+                pr_err("merge_k failed: k %zu, run length %zu, keys %llu\n",
+                       k, max_len, (unsigned long long) key_ranges[r]);
+                failed++;
+            }
+        }
+    }
+
+    printf("%u of %u checks passed\n", checks - failed, checks);
+    kfree(input);
+    kfree(ref);
+    kfree(arr);
+    kfree(tmp);
+    kfree(input32);
+    kfree(ref32);
+    kfree(arr32);
+    kfree(vals);
+    kfree(elems);
+    kfree(elems_arr);
+    return !!failed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n elements] [-r rounds] [-d random|runs] "
+            "[-e bytes] [-S seed] [-R] [-s sort]...\n"
+            "       %s -l\n"
+            "       %s -t\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 100000, rounds = 10, size = sizeof(uint64_t), i, r, j;
+    uint64_t s0 = 314159265, s1 = 1618033989;  // pi and phi
+    unsigned int dist = DIST_RANDOM;
+    const char *only[ARRAY_SIZE(bench_sorts)];
+    size_t n_only = 0;
+    uint64_t *keys, *ns;
+    char *input, *arr;
+    uint32_t *vals;
+    bool raw = false;
+    int opt, failed = 0;
+
+    while ((opt = getopt(argc, argv, "n:r:d:e:S:Rs:lt")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            if (!strcmp(optarg, "random"))
+                dist = DIST_RANDOM;
+            else if (!strcmp(optarg, "runs"))
+                dist = DIST_RUNS;
+            else {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'e':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            s0 = strtoull(optarg, NULL, 0);
+            s1 = ~s0;
+            break;
+        case 'R':
+            raw = true;
+            break;
+        case 's':
+            if (n_only < ARRAY_SIZE(only))
+                only[n_only++] = optarg;
+            break;
+        case 't':
+            return run_checks();
+        case 'l':
+            for (j = 0; j < ARRAY_SIZE(bench_sorts); j++)
+                printf("%s %s\n", bench_sorts[j].name,
+                       bench_sorts[j].elem_sort ? "any" : "8");
+            return 0;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (!n || !rounds || optind != argc ||
+        (size != 4 && (size < 8 || size > ELEM_SIZE_MAX))) {
+        usage(argv[0]);
+        return 2;
+    }
+    for (i = 0; i < n_only; i++) {
+        for (j = 0; j < ARRAY_SIZE(bench_sorts) &&
+                    strcmp(only[i], bench_sorts[j].name);
+             j++)
+            ;
+        if (j == ARRAY_SIZE(bench_sorts)) {
+            fprintf(stderr, "%s: no sort %s, see -l\n", argv[0], only[i]);
+            return 2;
+        }
+        if (!sorts_size(&bench_sorts[j], size)) {
+            fprintf(stderr, "%s: %s only sorts 8-byte elements\n", argv[0],
+                    only[i]);
+            return 2;
+        }
+    }
+
+    keys = kmalloc_array(n, sizeof(*keys), GFP_KERNEL);
+    input = kmalloc_array(n, size, GFP_KERNEL);
+    arr = kmalloc_array(n, size, GFP_KERNEL);
+    vals = kmalloc_array(n, sizeof(*vals), GFP_KERNEL);
+    ns = kmalloc_array(rounds, sizeof(*ns), GFP_KERNEL);
+    if (!keys || !input || !arr || !vals || !ns) {
+        perror("Failed to allocate the input");
+        return 1;
+    }
+
+    /* 4-byte keys keep the high half, which preserves the runs */
+    seed(s0, s1);
+    fill_dist(keys, n, dist);
+    memset(input, 0, n * size);
+    for (i = 0; i < n; i++) {
+        if (size == 4) {
+            const u32 key = keys[i] >> 32;
+
+            memcpy(input + i * size, &key, sizeof(key));
+        } else {
+            memcpy(input + i * size, &keys[i], sizeof(keys[i]));
+        }
+    }
+
+    if (raw)
+        printf("# sort elements bytes ns\n");
+    else
+        printf("# sort elements bytes min median ns/element\n");
+    for (j = 0; j < ARRAY_SIZE(bench_sorts); j++) {
+        const struct bench_sort *s = &bench_sorts[j];
+
+        if (n_only) {
+            for (i = 0; i < n_only && strcmp(only[i], s->name); i++)
+                ;
+            if (i == n_only)
+                continue;
+        } else if ((s->slow && n > SLOW_SORT_MAX) || !sorts_size(s, size)) {
+            continue;
+        }
+
+        for (r = 0; r < rounds; r++) {
+            if (!run_sort(s, arr, input, vals, n, size, &ns[r])) {
+                failed = 1;
+                break;
+            }
+            if (raw)
+                printf("%s %zu %zu %llu\n", s->name, n, size,
+                       (unsigned long long) ns[r]);
+        }
+        if (r < rounds || raw)
+            continue;
+
+        qsort(ns, rounds, sizeof(*ns), cmp_ns);
+        printf("%s %zu %zu %llu %llu %.2f\n", s->name, n, size,
+               (unsigned long long) ns[0],
+               (unsigned long long) ns[rounds / 2],
+               (double) ns[rounds / 2] / n);
+    }
+
+    kfree(keys);
+    kfree(input);
+    kfree(arr);
+    kfree(vals);
+    kfree(ns);
+    return failed;
+}
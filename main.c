@@ -1,18 +1,62 @@
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <linux/device.h>
 #include <linux/fs.h>
 #include <linux/init.h>
+#include <linux/irqflags.h>
+#include <linux/kernel_stat.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/random.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timex.h>
 #include <linux/uaccess.h>
 
+#ifdef CONFIG_X86_LOCAL_APIC
+#include <asm/hardirq.h>
+#endif
+
+#include "async.h"
+#include "ksort.h"
+#include "profile.h"
+#include "ring.h"
 #include "sort_impl.h"
 
+#define CREATE_TRACE_POINTS
+#include "ksort_trace.h"
+
 #define DEVICE_NAME "xoroshiro128p"
 #define CLASS_NAME "xoro"
 
+/* Tuning thresholds of the sort.h sorts, see the tune_knob parameters */
+static unsigned int ksort_small_sort_bnd = 16;
+static unsigned int ksort_minrun_bits = 6;
+static unsigned int ksort_auto_run_breaks = 8;
+static unsigned int ksort_auto_duplicates = 8;
+static unsigned int ksort_auto_radix_min = 1024;
+
 #define SORT_NAME ksort
 #define SORT_TYPE uint64_t
+#define SORT_RADIX_KEY(x) (x)
+#define SORT_PAYLOAD_TYPE uint32_t
+#define SORT_CHECKPOINT() ksort_checkpoint()
+#define SORT_CHECKPOINT_MIN KSORT_CHECKPOINT_MIN
+#define SMALL_SORT_BND READ_ONCE(ksort_small_sort_bnd)
+#define SORT_MINRUN_BITS READ_ONCE(ksort_minrun_bits)
+#define AUTO_SORT_RUN_BREAKS READ_ONCE(ksort_auto_run_breaks)
+#define AUTO_SORT_DUPLICATES READ_ONCE(ksort_auto_duplicates)
+#define AUTO_SORT_RADIX_MIN READ_ONCE(ksort_auto_radix_min)
+#define SORT_TRACE_TIM_PUSH(start, len) trace_ksort_tim_push(start, len)
+#define SORT_TRACE_TIM_MERGE(start, a, b) trace_ksort_tim_merge(start, a, b)
+#define SORT_TRACE_NEW_BUFFER(num, buf) \
+    trace_ksort_new_buffer(num, sizeof(SORT_TYPE), buf)
+#define SORT_PROFILE_BEGIN(phase) ksort_profile_begin(KSORT_PHASE_##phase)
+#define SORT_PROFILE_END(phase) ksort_profile_end(KSORT_PHASE_##phase)
 #include "sort.h"
 
 MODULE_LICENSE("GPL");
@@ -34,20 +78,108 @@ static int n_opens = 0;
 /* Mutex to allow only one userspace program to read at once */
 static DEFINE_MUTEX(xoroshiro128p_mutex);
 
+/* State of an open file: the asynchronous sort queue of ksort.h, and the
+ * sample stream, whose ring is created by the first mmap() or stream. */
+struct xoro_file {
+    struct ksort_async *async;
+    struct mutex lock; /* ring and streamer */
+    struct ksort_ring *ring;
+    struct task_struct *streamer;
+    u64 stream_rounds;
+    size_t stream_len;
+};
+
 /**
  * Devices are represented as file structure in the kernel.
  */
 static int dev_open(struct inode *, struct file *);
 static int dev_release(struct inode *, struct file *);
 static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
+static long dev_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t dev_poll(struct file *, poll_table *);
+static int dev_mmap(struct file *, struct vm_area_struct *);
 static struct file_operations fops = {
     .open = dev_open,
     .read = dev_read,
+    .unlocked_ioctl = dev_ioctl,
+    .poll = dev_poll,
+    .mmap = dev_mmap,
     .release = dev_release,
 };
 
 #define TEST_LEN 10
 
+/* Input distributions of the benchmark samples */
+#define DIST_RANDOM 0
+#define DIST_RUNS 1 /* ascending runs of random length, as seen by tim sort */
+
+static unsigned int bench_len = TEST_LEN;
+module_param(bench_len, uint, 0644);
+MODULE_PARM_DESC(bench_len, "Number of elements sorted per benchmark sample");
+
+static unsigned int bench_dist = DIST_RANDOM;
+module_param(bench_dist, uint, 0644);
+MODULE_PARM_DESC(bench_dist, "Benchmark input: 0 = random, 1 = many runs");
+
+/* Element sizes of the bench_sweep benchmark.  Every size is measured at an
+ * aligned base and at a base misaligned by one byte, for each of sort_heap(),
+ * sort_intro(), sort_pdqsort() and ksort_indirect(), in that order. */
+static const size_t sweep_sizes[] = {4, 8, 12, 16, 24, 32, 64, 128, 256};
+#define SWEEP_SIZES ARRAY_SIZE(sweep_sizes)
+#define SWEEP_ENGINES 4
+#define SWEEP_SAMPLES (SWEEP_SIZES * 2 * SWEEP_ENGINES)
+
+static bool bench_sweep;
+module_param(bench_sweep, bool, 0644);
+MODULE_PARM_DESC(bench_sweep,
+                 "Benchmark the void* engines across element sizes instead");
+
+/* APIs of the bench_select benchmark, in the order it reports them: a full
+ * sort_pdqsort() for reference, ksort_select() of the median, then
+ * ksort_partial_sort(), ksort_topk() and the ksort_topk_*() stream, each
+ * keeping the SELECT_K(n) smallest elements. */
+#define SELECT_APIS 5
+#define SELECT_K(n) ((n) / 100 + 1)
+
+static bool bench_select;
+module_param(bench_select, bool, 0644);
+MODULE_PARM_DESC(bench_select,
+                 "Benchmark selection, partial sort and top-k instead");
+
+/* With a CPU list, read() runs the benchmark in kernel threads bound to those
+ * CPUs, all at once, and returns one row of results per CPU.  Isolated CPUs
+ * (isolcpus=, nohz_full=) give the least noisy numbers. */
+static char *bench_cpus;
+module_param(bench_cpus, charp, 0644);
+MODULE_PARM_DESC(bench_cpus,
+                 "CPU list to run the benchmark on in pinned kernel threads");
+
+static bool bench_irqoff;
+module_param(bench_irqoff, bool, 0644);
+MODULE_PARM_DESC(bench_irqoff,
+                 "Disable local interrupts around the sorts that don't "
+                 "allocate");
+
+/* A sample is disturbed when an interrupt, a softirq or a context switch
+ * happened while it was timed; the stream tags such samples, and the threads
+ * of bench_cpus run the sort again instead of reporting them. */
+static unsigned int bench_reject = 3;
+module_param(bench_reject, uint, 0644);
+MODULE_PARM_DESC(bench_reject,
+                 "Times to rerun a disturbed sort on the bench_cpus threads");
+
+bool ksort_specialize = true;
+module_param_named(specialize, ksort_specialize, bool, 0644);
+MODULE_PARM_DESC(specialize,
+                 "Use the size-specialized loops of the void* engines");
+
+/* Read-only at runtime: the benchmark only disables preemption when this is
+ * false, and the engines must not reschedule inside that region. */
+bool ksort_cooperative;
+module_param_named(cooperative, ksort_cooperative, bool, 0444);
+MODULE_PARM_DESC(cooperative,
+                 "Let the sorts reschedule and run the benchmark preemptible");
+
 static int cmpint(const void *a, const void *b)
 {
     return *(int *) a - *(int *) b;
@@ -69,41 +201,1066 @@ static int cmpuint64(const void *a, const void *b)
     return *(uint64_t *) a < *(uint64_t *) b;
 }
 
+/* Element comparators of the bench_sweep benchmark.  The key is the leading
+ * u32 of 4-byte elements and the leading u64 of larger ones; memcpy() keeps
+ * the loads valid on misaligned elements. */
+static int cmp_key32(const void *a, const void *b)
+{
+    u32 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_key32(const void *a, const void *b)
+{
+    return cmp_key32(a, b) < 0;
+}
+
+static u64 prefix_key32(const void *a)
+{
+    u32 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+static int cmp_key64(const void *a, const void *b)
+{
+    u64 x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x < y ? -1 : x > y;
+}
+
+static int less_key64(const void *a, const void *b)
+{
+    return cmp_key64(a, b) < 0;
+}
+
+static u64 prefix_key64(const void *a)
+{
+    u64 x;
+
+    memcpy(&x, a, sizeof(x));
+    return x;
+}
+
+/** @brief Fill an array with one of the input distributions.
+ *  @param arr Array to fill.
+ *  @param n Number of elements.
+ *  @param dist DIST_RANDOM or DIST_RUNS.
+ *  @param rand Source of random numbers.
+ */
+static void fill_dist(uint64_t *arr,
+                      size_t n,
+                      unsigned int dist,
+                      uint64_t (*rand)(void))
+{
+    size_t i = 0;
+
+    if (dist != DIST_RUNS) {
+        for (; i < n; ++i)
+            arr[i] = rand();
+        return;
+    }
+
+    while (i < n) {
+        size_t run = 1 + rand() % 128;
+        uint64_t val = rand() >> 8;
+
+        for (; run && i < n; --run, ++i)
+            arr[i] = val += rand() >> 40;
+    }
+}
+
+/** @brief Fill the benchmark input according to bench_dist.
+ *  @param arr Array to fill.
+ *  @param n Number of elements.
+ */
+static void fill_input(uint64_t *arr, size_t n)
+{
+    fill_dist(arr, n, bench_dist, next);
+}
+
+/* The timed sorts normally run with preemption disabled, so that a sample is
+ * not stretched by other tasks.  Sorts that allocate may sleep, so they only
+ * stay on their CPU, whose interrupt counters bench_time() compares, with
+ * migrate_disable(); in the threads of bench_cpus, which kthread_bind()
+ * pins already, they need nothing at all.  In cooperative mode every sort
+ * stays preemptible and yields at its checkpoints instead, which keeps huge
+ * bench_len runs from triggering soft-lockup warnings. */
+static void bench_begin(bool allocates, bool pinned)
+{
+    if (ksort_cooperative || (allocates && pinned))
+        return;
+    if (allocates)
+        migrate_disable();
+    else
+        preempt_disable();
+}
+
+static void bench_end(bool allocates, bool pinned)
+{
+    if (ksort_cooperative || (allocates && pinned))
+        return;
+    if (allocates)
+        migrate_enable();
+    else
+        preempt_enable();
+}
+
+/** @brief Time the void* engines on n elements of every size in sweep_sizes.
+ *  @param times Receives SWEEP_SAMPLES times in ns, ordered by element size,
+ *         then alignment (aligned first), then engine.
+ *  @param n Number of elements.
+ *  @return Returns 0 if successful.
+ */
+static int bench_elem_sizes(uint64_t *times, size_t n)
+{
+    const size_t max_size = sweep_sizes[SWEEP_SIZES - 1];
+    char *src, *buf;
+    size_t s, i;
+    int a, e;
+
+    src = kvmalloc_array(n, max_size, GFP_KERNEL);
+    buf = kvmalloc(n * max_size + 1, GFP_KERNEL);
+    if (!src || !buf) {
+        kvfree(src);
+        kvfree(buf);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < n * max_size / sizeof(uint64_t); i++)
+        ((uint64_t *) src)[i] = next();
+
+    for (s = 0; s < SWEEP_SIZES; s++) {
+        const size_t size = sweep_sizes[s];
+        const bool wide = size >= sizeof(u64);
+        const cmp_func_t cmp = wide ? cmp_key64 : cmp_key32;
+
+        for (a = 0; a < 2; a++) {
+            char *base = buf + a;
+
+            for (e = 0; e < SWEEP_ENGINES; e++) {
+                const bool allocates = e != 0; /* all but sort_heap() */
+                ktime_t kt;
+
+                memcpy(base, src, n * size);
+                bench_begin(allocates, false);
+                kt = ktime_get();
+                switch (e) {
+                case 0:
+                    sort_heap(base, n, size, cmp, NULL);
+                    break;
+                case 1:
+                    sort_intro(base, n, size, cmp, NULL);
+                    break;
+                case 2:
+                    sort_pdqsort(base, n, size, wide ? less_key64 : less_key32,
+                                 NULL);
+                    break;
+                default:
+                    ksort_indirect(base, n, size, cmp,
+                                   wide ? prefix_key64 : prefix_key32);
+                    break;
+                }
+                kt = ktime_sub(ktime_get(), kt);
+                bench_end(allocates, false);
+                times[(s * 2 + a) * SWEEP_ENGINES + e] = ktime_to_ns(kt);
+
+                for (i = 1; i < n; i++)
+                    if (cmp(base + (i - 1) * size, base + i * size) > 0) {
+                        pr_err(
+                            "test has failed in element size sweep "
+                            "(size %zu, engine %d)\n",
+                            size, e);
+                        break;
+                    }
+            }
+        }
+    }
+
+    kvfree(src);
+    kvfree(buf);
+    return 0;
+}
+
+/** @brief Time the selection and top-k APIs on one input of n elements.
+ *  @param times Receives SELECT_APIS times in ns, in the order of
+ *         bench_select.
+ *  @param n Number of elements.
+ *  @return Returns 0 if successful.
+ */
+static int bench_select_apis(uint64_t *times, size_t n)
+{
+    const size_t k = min(SELECT_K(n), n);
+    uint64_t *arr, *buf, *heap;
+    struct ksort_topk t;
+    size_t i, kept = 0;
+    int api;
+
+    arr = kvmalloc_array(n, sizeof(*arr), GFP_KERNEL);
+    buf = kvmalloc_array(n, sizeof(*buf), GFP_KERNEL);
+    heap = kvmalloc_array(k, sizeof(*heap), GFP_KERNEL);
+    if (!arr || !buf || !heap) {
+        kvfree(arr);
+        kvfree(buf);
+        kvfree(heap);
+        return -ENOMEM;
+    }
+    fill_input(arr, n);
+
+    for (api = 0; api < SELECT_APIS; api++) {
+        /* sort_pdqsort(), also under ksort_partial_sort() */
+        const bool allocates = api == 0 || api == 2;
+        ktime_t kt;
+
+        memcpy(buf, arr, n * sizeof(*buf));
+        bench_begin(allocates, false);
+        kt = ktime_get();
+        switch (api) {
+        case 0:
+            sort_pdqsort(buf, n, sizeof(*buf), cmpuint64, NULL);
+            break;
+        case 1:
+            ksort_select(buf, n, sizeof(*buf), n / 2, cmpuint64);
+            break;
+        case 2:
+            ksort_partial_sort(buf, n, sizeof(*buf), k, cmpuint64, NULL);
+            break;
+        case 3:
+            ksort_topk(buf, n, sizeof(*buf), k, cmpint64, NULL);
+            break;
+        default:
+            ksort_topk_init(&t, heap, k, sizeof(*heap), cmpint64, NULL);
+            for (i = 0; i < n; i++)
+                ksort_topk_push(&t, &buf[i]);
+            kept = ksort_topk_finish(&t);
+            break;
+        }
+        kt = ktime_sub(ktime_get(), kt);
+        bench_end(allocates, false);
+        times[api] = ktime_to_ns(kt);
+
+        if (api == 1) {
+            for (i = 0; i < n; i++)
+                if (i < n / 2 ? buf[i] > buf[n / 2] : buf[i] < buf[n / 2]) {
+                    pr_err("test has failed in select\n");
+                    break;
+                }
+            continue;
+        }
+        if (api == SELECT_APIS - 1) {
+            if (kept != k)
+                pr_err("test has failed in top-k stream\n");
+            memcpy(buf, heap, kept * sizeof(*buf));
+        }
+        for (i = 1; i < (api ? k : n); i++)
+            if (buf[i - 1] > buf[i]) {
+                pr_err("test has failed in select API %d\n", api);
+                break;
+            }
+    }
+
+    kvfree(arr);
+    kvfree(buf);
+    kvfree(heap);
+    return 0;
+}
+
+/* The sorts of the benchmark, in the column order of dev_read(), with the
+ * signature of the KV engines; vals holds 0, 1, ... n - 1 on every call. */
+typedef void (*bench_sort_t)(uint64_t *arr, uint32_t *vals, size_t n);
+
+#define BENCH_SORT(name)                                              \
+    static void bench_##name(uint64_t *arr, uint32_t *vals, size_t n) \
+    {                                                                 \
+        ksort_##name(arr, n);                                         \
+    }
+#define BENCH_KV_SORT(name)                                           \
+    static void bench_##name(uint64_t *arr, uint32_t *vals, size_t n) \
+    {                                                                 \
+        ksort_##name(arr, vals, n);                                   \
+    }
+
+static void bench_kernel_heap_sort(uint64_t *arr, uint32_t *vals, size_t n)
+{
+    sort_heap(arr, n, sizeof(*arr), cmpint64, NULL);
+}
+
+static void bench_intro_sort(uint64_t *arr, uint32_t *vals, size_t n)
+{
+    sort_intro(arr, n, sizeof(*arr), cmpint64, NULL);
+}
+
+static void bench_pdqsort(uint64_t *arr, uint32_t *vals, size_t n)
+{
+    sort_pdqsort(arr, n, sizeof(*arr), cmpuint64, NULL);
+}
+
+BENCH_SORT(merge_sort)
+BENCH_SORT(shell_sort)
+BENCH_SORT(binary_insertion_sort)
+BENCH_SORT(heap_sort)
+BENCH_SORT(quick_sort)
+BENCH_SORT(selection_sort)
+BENCH_SORT(tim_sort)
+BENCH_SORT(bubble_sort)
+BENCH_SORT(bitonic_sort)
+BENCH_SORT(merge_sort_in_place)
+BENCH_SORT(grail_sort)
+BENCH_SORT(sqrt_sort)
+BENCH_SORT(rec_stable_sort)
+BENCH_SORT(grail_sort_dyn_buffer)
+BENCH_SORT(power_sort)
+BENCH_SORT(merge_sort_bottom_up)
+BENCH_SORT(radix_sort)
+BENCH_SORT(auto)
+BENCH_KV_SORT(kv_quick_sort)
+BENCH_KV_SORT(kv_merge_sort)
+BENCH_KV_SORT(kv_radix_sort)
+BENCH_SORT(weak_heap_sort)
+BENCH_SORT(smooth_sort)
+
+#undef BENCH_SORT
+#undef BENCH_KV_SORT
+
+/* A sort of the benchmark; the ones that allocate their buffers inside the
+ * timed region never run with interrupts disabled, see bench_irqoff.  That
+ * comes from the engine, see sort.h and sort_impl.h.  The KV sorts must
+ * also carry every payload along with its key. */
+struct bench_sort {
+    const char *name;
+    bench_sort_t sort;
+    bool allocates;
+    bool kv;
+};
+
+#define BENCH_ENTRY(name) {#name, bench_##name, ksort_##name##_allocates}
+#define BENCH_KV_ENTRY(name) \
+    {#name, bench_##name, ksort_##name##_allocates, true}
+
+static const struct bench_sort bench_sorts[] = {
+    {"kernel_heap_sort", bench_kernel_heap_sort, false},
+    BENCH_ENTRY(merge_sort),
+    BENCH_ENTRY(shell_sort),
+    BENCH_ENTRY(binary_insertion_sort),
+    BENCH_ENTRY(heap_sort),
+    BENCH_ENTRY(quick_sort),
+    BENCH_ENTRY(selection_sort),
+    BENCH_ENTRY(tim_sort),
+    BENCH_ENTRY(bubble_sort),
+    BENCH_ENTRY(bitonic_sort),
+    BENCH_ENTRY(merge_sort_in_place),
+    BENCH_ENTRY(grail_sort),
+    BENCH_ENTRY(sqrt_sort),
+    BENCH_ENTRY(rec_stable_sort),
+    BENCH_ENTRY(grail_sort_dyn_buffer),
+    {"intro_sort", bench_intro_sort, sort_intro_allocates(sizeof(uint64_t))},
+    {"pdqsort", bench_pdqsort, sort_pdqsort_allocates(sizeof(uint64_t))},
+    BENCH_ENTRY(power_sort),
+    BENCH_ENTRY(merge_sort_bottom_up),
+    BENCH_ENTRY(radix_sort),
+    BENCH_ENTRY(auto),
+    BENCH_KV_ENTRY(kv_quick_sort),
+    BENCH_KV_ENTRY(kv_merge_sort),
+    BENCH_KV_ENTRY(kv_radix_sort),
+    BENCH_ENTRY(weak_heap_sort),
+    BENCH_ENTRY(smooth_sort),
+};
+
+#undef BENCH_ENTRY
+#undef BENCH_KV_ENTRY
+
+/* Samples of every sort of bench_sorts, as read() and the threads of
+ * bench_cpus return them: the times in ns, then the KSORT_SAMPLE_* flags */
+#define BENCH_SAMPLES (2 * ARRAY_SIZE(bench_sorts))
+
+/* Interrupt and scheduling activity of a CPU and task, compared before and
+ * after a timed sort to tell whether anything else ran in the middle */
+struct bench_noise {
+    unsigned int cpu;
+    u64 irqs;
+    u64 softirqs;
+    u64 csw;
+};
+
+/** @brief Snapshot the activity counters of the current CPU and task.
+ *         Device interrupts are counted by kstat; on x86 the local APIC
+ *         timer is counted apart from them, so it is added in as well.
+ *  @param noise Receives the counters.
+ */
+static void bench_noise_snap(struct bench_noise *noise)
+{
+    const unsigned int cpu = raw_smp_processor_id();
+    int i;
+
+    noise->cpu = cpu;
+    noise->irqs = kstat_cpu_irqs_sum(cpu);
+#ifdef CONFIG_X86_LOCAL_APIC
+    noise->irqs += per_cpu(irq_stat, cpu).apic_timer_irqs;
+#endif
+    noise->softirqs = 0;
+    for (i = 0; i < NR_SOFTIRQS; i++)
+        noise->softirqs += kstat_softirqs_cpu(i, cpu);
+    noise->csw = current->nvcsw + current->nivcsw;
+}
+
+/** @brief Time one sort of bench_sorts on a copy of the input.
+ *  @param j Index of the sort in bench_sorts.
+ *  @param arr Input, left untouched.
+ *  @param arr_copy Array of n elements sorted in its place.
+ *  @param vals Array of n payloads of the KV sorts.
+ *  @param n Number of elements.
+ *  @param pinned Whether the thread is bound to its CPU.
+ *  @param sample Receives the time, cycles and disturbances of the sort.
+ */
+static void bench_time(size_t j,
+                       const uint64_t *arr,
+                       uint64_t *arr_copy,
+                       uint32_t *vals,
+                       size_t n,
+                       bool pinned,
+                       struct ksort_sample *sample)
+{
+    const bool allocates = bench_sorts[j].allocates;
+    const bool irqoff = bench_irqoff && !ksort_cooperative && !allocates;
+    struct bench_noise before, after;
+    struct ksort_phases phases_before, phases_after;
+    unsigned long flags = 0;
+    cycles_t c;
+    ktime_t kt;
+    size_t i;
+
+    memcpy(arr_copy, arr, n * sizeof(*arr));
+    for (i = 0; i < n; i++)
+        vals[i] = i;
+
+    bench_begin(allocates, pinned);
+    if (irqoff)
+        local_irq_save(flags);
+    bench_noise_snap(&before);
+    ksort_profile_snap(&phases_before);
+    kt = ktime_get();
+    c = get_cycles();
+    bench_sorts[j].sort(arr_copy, vals, n);
+    sample->cycles = get_cycles() - c;
+    sample->ns = ktime_to_ns(ktime_sub(ktime_get(), kt));
+    ksort_profile_snap(&phases_after);
+    bench_noise_snap(&after);
+    if (irqoff)
+        local_irq_restore(flags);
+    bench_end(allocates, pinned);
+
+    sample->flags = 0;
+    if (after.cpu != before.cpu) {
+        /* The counters of two CPUs can't be compared */
+        sample->irqs = sample->softirqs = 0;
+        sample->flags |= KSORT_SAMPLE_MIGRATED;
+    } else {
+        sample->irqs = after.irqs - before.irqs;
+        sample->softirqs = after.softirqs - before.softirqs;
+        ksort_profile_record(j, sample->cycles, &phases_before,
+                             &phases_after);
+    }
+    sample->csw = after.csw - before.csw;
+    if (sample->irqs || sample->softirqs || sample->csw || sample->flags)
+        sample->flags |= KSORT_SAMPLE_DISTURBED;
+}
+
+/** @brief Check the result of a sort timed by bench_time().
+ *  @param j Index of the sort in bench_sorts.
+ *  @param arr Input of the sort.
+ *  @param arr_copy The sorted array.
+ *  @param vals The payloads, for the KV sorts.
+ *  @param n Number of elements.
+ */
+static void bench_check(size_t j,
+                        const uint64_t *arr,
+                        const uint64_t *arr_copy,
+                        const uint32_t *vals,
+                        size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if ((i && arr_copy[i - 1] > arr_copy[i]) ||
+            (bench_sorts[j].kv && arr[vals[i]] != arr_copy[i])) {
+            pr_err("test has failed in %s\n", bench_sorts[j].name);
+            break;
+        }
+}
+
+/*
+ * Tuning thresholds.  Each one is a module parameter, read/write in
+ * /sys/module/ksort/parameters/, that only accepts values in its range.
+ * Writing 1 to calibrate, or loading the module with calibrate=1, picks them
+ * for the running CPU instead: every threshold in turn is set to each of its
+ * candidates while the others stay, and keeps the one under which its sorts
+ * were fastest, taking the best of TUNE_ROUNDS runs on TUNE_LEN elements of
+ * both input distributions.  That takes well under a second.  The thresholds
+ * without candidates are not calibrated: neither distribution has duplicates
+ * or is shorter than TUNE_LEN, so the auto sort would not see them.
+ */
+unsigned int ksort_pdq_insertion_threshold = 24;
+unsigned int ksort_pdq_ninther_threshold = 128;
+unsigned int ksort_pdq_partial_insertion_limit = 8;
+unsigned int ksort_intro_threshold = 16;
+
+#define TUNE_LEN 8192
+#define TUNE_ROUNDS 8
+
+struct tune_knob {
+    const char *name;
+    unsigned int *value;
+    unsigned int min, max;
+    const unsigned int *candidates; /* tried by calibrate, 0-terminated,
+                                     * or NULL */
+    bench_sort_t sorts[2];          /* timed by calibrate, NULL if unused */
+};
+
+static struct tune_knob tune_small_sort_bnd = {
+    "small_sort_bnd", &ksort_small_sort_bnd, 16, 128,
+    (const unsigned int[]){16, 24, 32, 48, 64, 0},
+    {bench_merge_sort, bench_quick_sort},
+};
+
+static struct tune_knob tune_minrun_bits = {
+    "minrun_bits", &ksort_minrun_bits, 3, 8,
+    (const unsigned int[]){4, 5, 6, 7, 0},
+    {bench_tim_sort, bench_power_sort},
+};
+
+static struct tune_knob tune_pdq_insertion_threshold = {
+    "pdq_insertion_threshold", &ksort_pdq_insertion_threshold, 8, 128,
+    (const unsigned int[]){12, 16, 24, 32, 48, 0},
+    {bench_pdqsort},
+};
+
+static struct tune_knob tune_pdq_ninther_threshold = {
+    "pdq_ninther_threshold", &ksort_pdq_ninther_threshold, 16, 1024,
+    (const unsigned int[]){64, 128, 256, 512, 0},
+    {bench_pdqsort},
+};
+
+static struct tune_knob tune_pdq_partial_insertion_limit = {
+    "pdq_partial_insertion_limit", &ksort_pdq_partial_insertion_limit, 0, 64,
+    (const unsigned int[]){4, 8, 16, 32, 0},
+    {bench_pdqsort},
+};
+
+static struct tune_knob tune_intro_threshold = {
+    "intro_threshold", &ksort_intro_threshold, 4, 128,
+    (const unsigned int[]){8, 12, 16, 24, 32, 0},
+    {bench_intro_sort},
+};
+
+static struct tune_knob tune_auto_run_breaks = {
+    "auto_run_breaks", &ksort_auto_run_breaks, 0, 128,
+    (const unsigned int[]){2, 4, 8, 16, 32, 0},
+    {bench_auto},
+};
+
+static struct tune_knob tune_auto_duplicates = {
+    "auto_duplicates", &ksort_auto_duplicates, 1, 16,
+};
+
+static struct tune_knob tune_auto_radix_min = {
+    "auto_radix_min", &ksort_auto_radix_min, 64, 65536,
+};
+
+/* In the order calibrate tunes them */
+static struct tune_knob *const tune_knobs[] = {
+    &tune_small_sort_bnd,
+    &tune_minrun_bits,
+    &tune_pdq_insertion_threshold,
+    &tune_pdq_ninther_threshold,
+    &tune_pdq_partial_insertion_limit,
+    &tune_intro_threshold,
+    &tune_auto_run_breaks,
+    &tune_auto_duplicates,
+    &tune_auto_radix_min,
+};
+
+static int tune_set(const char *val, const struct kernel_param *kp)
+{
+    const struct tune_knob *k = kp->arg;
+    unsigned int v;
+    int err = kstrtouint(val, 0, &v);
+
+    if (err)
+        return err;
+    if (v < k->min || v > k->max)
+        return -EINVAL;
+    WRITE_ONCE(*k->value, v);
+    return 0;
+}
+
+static int tune_get(char *buffer, const struct kernel_param *kp)
+{
+    const struct tune_knob *k = kp->arg;
+
+    return sprintf(buffer, "%u\n", READ_ONCE(*k->value));
+}
+
+static const struct kernel_param_ops tune_ops = {
+    .set = tune_set,
+    .get = tune_get,
+};
+
+module_param_cb(small_sort_bnd, &tune_ops, &tune_small_sort_bnd, 0644);
+MODULE_PARM_DESC(small_sort_bnd,
+                 "Ranges the sort.h sorts hand to their small sort (16-128)");
+module_param_cb(minrun_bits, &tune_ops, &tune_minrun_bits, 0644);
+MODULE_PARM_DESC(minrun_bits,
+                 "Tim and power sort runs are at least 2^(bits-1) long (3-8)");
+module_param_cb(pdq_insertion_threshold,
+                &tune_ops,
+                &tune_pdq_insertion_threshold,
+                0644);
+MODULE_PARM_DESC(pdq_insertion_threshold,
+                 "pdqsort insertion sorts ranges below this size (8-128)");
+module_param_cb(pdq_ninther_threshold,
+                &tune_ops,
+                &tune_pdq_ninther_threshold,
+                0644);
+MODULE_PARM_DESC(pdq_ninther_threshold,
+                 "pdqsort takes the ninther as pivot above this size "
+                 "(16-1024)");
+module_param_cb(pdq_partial_insertion_limit,
+                &tune_ops,
+                &tune_pdq_partial_insertion_limit,
+                0644);
+MODULE_PARM_DESC(pdq_partial_insertion_limit,
+                 "Moves before pdqsort gives up finishing by insertion "
+                 "(0-64)");
+module_param_cb(intro_threshold, &tune_ops, &tune_intro_threshold, 0644);
+MODULE_PARM_DESC(intro_threshold,
+                 "intro leaves ranges up to this size to its final pass "
+                 "(4-128)");
+module_param_cb(auto_run_breaks, &tune_ops, &tune_auto_run_breaks, 0644);
+MODULE_PARM_DESC(auto_run_breaks,
+                 "auto takes tim sort when at most this many of 256 sampled "
+                 "pairs break the order (0-128)");
+module_param_cb(auto_duplicates, &tune_ops, &tune_auto_duplicates, 0644);
+MODULE_PARM_DESC(auto_duplicates,
+                 "auto takes quick sort when this many of 16 sampled keys "
+                 "repeat (1-16)");
+module_param_cb(auto_radix_min, &tune_ops, &tune_auto_radix_min, 0644);
+MODULE_PARM_DESC(auto_radix_min,
+                 "auto takes radix sort from this many elements on "
+                 "(64-65536)");
+
+/** @brief Time the sorts of a knob at its current value.
+ *  @param k The knob.
+ *  @param inputs One input of TUNE_LEN elements per distribution.
+ *  @param arr Array of TUNE_LEN elements sorted in its place.
+ *  @return Returns the best time of TUNE_ROUNDS runs in ns, summed over the
+ *          sorts and inputs.
+ */
+static u64 tune_time(const struct tune_knob *k,
+                     uint64_t *const inputs[2],
+                     uint64_t *arr)
+{
+    u64 total = 0;
+    size_t s;
+    int d, r;
+
+    for (d = 0; d < 2; d++) {
+        for (s = 0; s < ARRAY_SIZE(k->sorts) && k->sorts[s]; s++) {
+            u64 best = U64_MAX;
+
+            for (r = 0; r < TUNE_ROUNDS; r++) {
+                ktime_t kt;
+
+                /* All the tuned sorts but quick sort allocate; time every
+                 * one the same way */
+                memcpy(arr, inputs[d], TUNE_LEN * sizeof(*arr));
+                bench_begin(true, false);
+                kt = ktime_get();
+                k->sorts[s](arr, NULL, TUNE_LEN);
+                kt = ktime_sub(ktime_get(), kt);
+                bench_end(true, false);
+                best = min_t(u64, best, ktime_to_ns(kt));
+            }
+            total += best;
+        }
+    }
+    return total;
+}
+
+/** @brief Pick every tuning threshold for the running CPU.
+ *         The inputs come from get_random_u64(), so that the sequence of
+ *         the benchmark generator is the same with or without calibration.
+ *  @return Returns 0 if successful.
+ */
+static int tune_calibrate(void)
+{
+    uint64_t *inputs[2], *arr;
+    int err = -ENOMEM;
+    size_t i;
+
+    inputs[0] = kvmalloc_array(TUNE_LEN, sizeof(uint64_t), GFP_KERNEL);
+    inputs[1] = kvmalloc_array(TUNE_LEN, sizeof(uint64_t), GFP_KERNEL);
+    arr = kvmalloc_array(TUNE_LEN, sizeof(uint64_t), GFP_KERNEL);
+    if (!inputs[0] || !inputs[1] || !arr)
+        goto out;
+    fill_dist(inputs[0], TUNE_LEN, DIST_RANDOM, get_random_u64);
+    fill_dist(inputs[1], TUNE_LEN, DIST_RUNS, get_random_u64);
+
+    for (i = 0; i < ARRAY_SIZE(tune_knobs); i++) {
+        struct tune_knob *k = tune_knobs[i];
+        unsigned int best = READ_ONCE(*k->value);
+        u64 best_ns = U64_MAX;
+        const unsigned int *c;
+
+        if (!k->candidates)
+            continue;
+        for (c = k->candidates; *c; c++) {
+            u64 ns;
+
+            WRITE_ONCE(*k->value, *c);
+            ns = tune_time(k, inputs, arr);
+            if (ns < best_ns) {
+                best_ns = ns;
+                best = *c;
+            }
+        }
+        WRITE_ONCE(*k->value, best);
+        pr_info("ksort: calibrated %s = %u\n", k->name, best);
+    }
+    err = 0;
+
+out:
+    kvfree(inputs[0]);
+    kvfree(inputs[1]);
+    kvfree(arr);
+    return err;
+}
+
+/* Set once xoro_init() is done; a calibrate=1 given at load is acted on by
+ * xoro_init() itself, the ones written later by calibrate_set() */
+static bool tune_live;
+static bool calibrate;
+
+static int calibrate_set(const char *val, const struct kernel_param *kp)
+{
+    int err = param_set_bool(val, kp);
+
+    if (err || !calibrate || !tune_live)
+        return err;
+
+    /* The benchmark would time the sorts with moving thresholds */
+    if (!mutex_trylock(&xoroshiro128p_mutex))
+        return -EBUSY;
+    err = tune_calibrate();
+    mutex_unlock(&xoroshiro128p_mutex);
+    return err;
+}
+
+static const struct kernel_param_ops calibrate_ops = {
+    .set = calibrate_set,
+    .get = param_get_bool,
+};
+
+module_param_cb(calibrate, &calibrate_ops, &calibrate, 0644);
+MODULE_PARM_DESC(calibrate,
+                 "Pick the tuning thresholds for this CPU (at load, or on "
+                 "writing 1)");
+
+/* A benchmark thread of bench_cpus */
+struct bench_runner {
+    struct task_struct *task;
+    struct completion done;
+    const uint64_t *arr; /* input shared by all the runners */
+    size_t n;
+    uint64_t samples[BENCH_SAMPLES];
+    int err;
+};
+
+/** @brief Body of a benchmark thread: time every sort of bench_sorts once.
+ *         A disturbed sort runs again up to bench_reject times; if the last
+ *         run is still disturbed, its flags say so.
+ *  @param data The struct bench_runner of the thread.
+ */
+static int bench_run_cpu(void *data)
+{
+    struct bench_runner *r = data;
+    struct ksort_sample sample;
+    uint64_t *arr_copy;
+    uint32_t *vals;
+    size_t j;
+
+    /* Allocated on the CPU of the thread, so that the memory is local */
+    arr_copy = kvmalloc_array(r->n, sizeof(*arr_copy), GFP_KERNEL);
+    vals = kvmalloc_array(r->n, sizeof(*vals), GFP_KERNEL);
+    if (!arr_copy || !vals) {
+        r->err = -ENOMEM;
+        goto out;
+    }
+
+    for (j = 0; j < ARRAY_SIZE(bench_sorts); j++) {
+        unsigned int tries = 0;
+
+        do {
+            bench_time(j, r->arr, arr_copy, vals, r->n, true, &sample);
+        } while ((sample.flags & KSORT_SAMPLE_DISTURBED) &&
+                 tries++ < bench_reject);
+        r->samples[j] = sample.ns;
+        r->samples[ARRAY_SIZE(bench_sorts) + j] = sample.flags;
+    }
+
+out:
+    kvfree(arr_copy);
+    kvfree(vals);
+    complete(&r->done);
+    return 0;
+}
+
+/** @brief The read() benchmark on the CPUs of bench_cpus.
+ *         One thread is bound to each online CPU of the list, and all of
+ *         them sort the same input at the same time.
+ *  @param buffer User buffer receiving one row of BENCH_SAMPLES times and
+ *         flags per CPU, in the order of the list.
+ *  @param len Size of the buffer.
+ *  @param n Number of elements.
+ *  @return Returns number of bytes successfully read. Negative on error.
+ */
+static ssize_t bench_on_cpus(char *buffer, size_t len, size_t n)
+{
+    struct bench_runner *runners = NULL;
+    cpumask_var_t mask;
+    uint64_t *arr = NULL;
+    unsigned int cpu, nr = 0, i;
+    ssize_t ret;
+
+    if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+        return -ENOMEM;
+    ret = cpulist_parse(bench_cpus, mask);
+    if (ret)
+        goto out;
+    cpumask_and(mask, mask, cpu_online_mask);
+    ret = -EINVAL;
+    if (cpumask_empty(mask))
+        goto out;
+
+    ret = -ENOMEM;
+    runners = kcalloc(cpumask_weight(mask), sizeof(*runners), GFP_KERNEL);
+    arr = kvmalloc_array(n, sizeof(*arr), GFP_KERNEL);
+    if (!runners || !arr)
+        goto out;
+    fill_input(arr, n);
+
+    /* Create every thread before waking any, so that they start together */
+    for_each_cpu (cpu, mask) {
+        struct bench_runner *r = &runners[nr];
+        struct task_struct *task;
+
+        init_completion(&r->done);
+        r->arr = arr;
+        r->n = n;
+        task = kthread_create(bench_run_cpu, r, "ksort-bench/%u", cpu);
+        if (IS_ERR(task)) {
+            ret = PTR_ERR(task);
+            while (nr--)
+                kthread_stop(runners[nr].task);
+            goto out;
+        }
+        kthread_bind(task, cpu);
+        r->task = task;
+        nr++;
+    }
+    for (i = 0; i < nr; i++)
+        wake_up_process(runners[i].task);
+
+    ret = 0;
+    for (i = 0; i < nr; i++) {
+        wait_for_completion(&runners[i].done);
+        if (runners[i].err)
+            ret = runners[i].err;
+    }
+    if (ret)
+        goto out;
+
+    for (i = 0; i < nr && len; i++) {
+        size_t chunk = min(len, sizeof(runners->samples));
+
+        if (copy_to_user(buffer + ret, runners[i].samples, chunk)) {
+            ret = -EFAULT;
+            goto out;
+        }
+        ret += chunk;
+        len -= chunk;
+    }
+
+out:
+    kvfree(arr);
+    kfree(runners);
+    free_cpumask_var(mask);
+    return ret;
+}
+
+/** @brief Benchmark thread of a sample stream.
+ *         Runs every sort of bench_sorts on fresh input stream_rounds times
+ *         and pushes one sample per sort into the ring, waiting while it is
+ *         full.  Stays around once done until KSORT_IOC_STREAM_STOP or
+ *         close() stops it.
+ *  @param data The struct xoro_file of the stream.
+ */
+static int bench_stream(void *data)
+{
+    struct xoro_file *xf = data;
+    const size_t n = xf->stream_len;
+    uint64_t *arr, *arr_copy;
+    uint32_t *vals;
+    u64 round;
+    size_t j;
+
+    arr = kvmalloc_array(n, sizeof(*arr), GFP_KERNEL);
+    arr_copy = kvmalloc_array(n, sizeof(*arr_copy), GFP_KERNEL);
+    vals = kvmalloc_array(n, sizeof(*vals), GFP_KERNEL);
+    if (!arr || !arr_copy || !vals)
+        goto out;
+
+    for (round = 0; round < xf->stream_rounds; round++) {
+        fill_input(arr, n);
+
+        for (j = 0; j < ARRAY_SIZE(bench_sorts); j++) {
+            struct ksort_sample sample = {
+                .algo = j,
+                .dist = bench_dist,
+                .num = n,
+            };
+
+            bench_time(j, arr, arr_copy, vals, n, false, &sample);
+
+            while (!ksort_ring_push(xf->ring, &sample)) {
+                if (kthread_should_stop())
+                    goto out;
+                schedule_timeout_interruptible(1);
+            }
+        }
+
+        if (kthread_should_stop())
+            break;
+    }
+
+out:
+    kvfree(arr);
+    kvfree(arr_copy);
+    kvfree(vals);
+    ksort_ring_finish(xf->ring);
+
+    /* kthread_stop() expects to find the thread still running */
+    set_current_state(TASK_INTERRUPTIBLE);
+    while (!kthread_should_stop()) {
+        schedule();
+        set_current_state(TASK_INTERRUPTIBLE);
+    }
+    __set_current_state(TASK_RUNNING);
+    return 0;
+}
+
+/* Create the ring of an open file on first use; called with xf->lock held */
+static int xoro_ring(struct xoro_file *xf)
+{
+    if (!xf->ring)
+        xf->ring = ksort_ring_create();
+    return xf->ring ? 0 : -ENOMEM;
+}
+
+/** @brief Start a sample stream (KSORT_IOC_STREAM_START).
+ *  @param xf State of the open file.
+ *  @param argp The struct ksort_stream argument.
+ *  @return Returns 0 if successful.
+ */
+static long stream_start(struct xoro_file *xf, struct ksort_stream __user *argp)
+{
+    struct ksort_stream st;
+    struct task_struct *task;
+    int err;
+
+    if (copy_from_user(&st, argp, sizeof(st)))
+        return -EFAULT;
+
+    mutex_lock(&xf->lock);
+    err = xf->streamer ? -EBUSY : xoro_ring(xf);
+    if (err)
+        goto unlock;
+
+    ksort_ring_reset(xf->ring);
+    xf->stream_rounds = st.rounds;
+    xf->stream_len = st.len ? st.len : (bench_len ? bench_len : TEST_LEN);
+    task = kthread_run(bench_stream, xf, "ksort-stream");
+    if (IS_ERR(task))
+        err = PTR_ERR(task);
+    else
+        xf->streamer = task;
+unlock:
+    mutex_unlock(&xf->lock);
+    return err;
+}
+
+/** @brief Stop the sample stream of an open file, if there is one.
+ *  @param xf State of the open file.
+ */
+static void stream_stop(struct xoro_file *xf)
+{
+    mutex_lock(&xf->lock);
+    if (xf->streamer) {
+        kthread_stop(xf->streamer);
+        xf->streamer = NULL;
+    }
+    mutex_unlock(&xf->lock);
+}
+
 /** @brief Initialize /dev/xoroshiro128p.
  *  @return Returns 0 if successful.
  */
 static int __init xoro_init(void)
 {
-    int *a, i, r = 1, err = -ENOMEM;
+    int *a, i, r = 1, err;
+
+    BUILD_BUG_ON(ARRAY_SIZE(bench_sorts) != KSORT_BENCH_SORTS);
+
+    err = ksort_async_init();
+    if (err)
+        return err;
+    ksort_profile_init();
+
     major_number = register_chrdev(0, DEVICE_NAME, &fops);
     if (0 > major_number) {
         printk(KERN_ALERT "XORO: Failed to register major_number\n");
-        return major_number;
+        err = major_number;
+        goto err_async;
     }
 
     dev_class = class_create(THIS_MODULE, CLASS_NAME);
     if (IS_ERR(dev_class)) {
-        unregister_chrdev(major_number, DEVICE_NAME);
         printk(KERN_ALERT "XORO: Failed to create dev_class\n");
-        return PTR_ERR(dev_class);
+        err = PTR_ERR(dev_class);
+        goto err_chrdev;
     }
 
     dev_device = device_create(dev_class, NULL, MKDEV(major_number, 0), NULL,
                                DEVICE_NAME);
     if (IS_ERR(dev_device)) {
-        class_destroy(dev_class);
-        unregister_chrdev(major_number, DEVICE_NAME);
         printk(KERN_ALERT "XORO: Failed to create dev_device\n");
-        return PTR_ERR(dev_device);
+        err = PTR_ERR(dev_device);
+        goto err_class;
     }
 
     mutex_init(&xoroshiro128p_mutex);
 
     seed(314159265, 1618033989);  // Initialize PRNG with pi and phi.
 
+    err = -ENOMEM;
     a = kmalloc_array(TEST_LEN, sizeof(*a), GFP_KERNEL);
     if (!a)
-        return err;
+        goto err_device;
 
     for (i = 0; i < TEST_LEN; i++) {
         r = (r * 725861) % 6599;
@@ -116,12 +1273,28 @@ static int __init xoro_init(void)
     for (i = 0; i < TEST_LEN - 1; i++)
         if (a[i] > a[i + 1]) {
             pr_err("test has failed\n");
-            goto exit;
+            goto err_test;
         }
-    err = 0;
+    kfree(a);
     pr_info("test passed\n");
-exit:
+
+    if (calibrate && tune_calibrate())
+        pr_warn("ksort: calibration failed, keeping the thresholds\n");
+    tune_live = true;
+    return 0;
+
+    /* Undo the steps above in reverse, as xoro_exit() does */
+err_test:
     kfree(a);
+err_device:
+    mutex_destroy(&xoroshiro128p_mutex);
+    device_destroy(dev_class, MKDEV(major_number, 0));
+err_class:
+    class_destroy(dev_class);
+err_chrdev:
+    unregister_chrdev(major_number, DEVICE_NAME);
+err_async:
+    ksort_async_exit();
     return err;
 }
 
@@ -138,6 +1311,8 @@ static void __exit xoro_exit(void)
     class_destroy(dev_class);
 
     unregister_chrdev(major_number, DEVICE_NAME);
+
+    ksort_async_exit();
 }
 
 /** @brief open() syscall.
@@ -148,12 +1323,25 @@ static void __exit xoro_exit(void)
  */
 static int dev_open(struct inode *inodep, struct file *filep)
 {
+    struct xoro_file *xf;
+
     /* Try to acquire the mutex (returns 0 on fail) */
     if (!mutex_trylock(&xoroshiro128p_mutex)) {
         printk(KERN_INFO "XORO: %s busy\n", DEVICE_NAME);
         return -EBUSY;
     }
 
+    xf = kzalloc(sizeof(*xf), GFP_KERNEL);
+    if (xf)
+        xf->async = ksort_async_create();
+    if (!xf || !xf->async) {
+        kfree(xf);
+        mutex_unlock(&xoroshiro128p_mutex);
+        return -ENOMEM;
+    }
+    mutex_init(&xf->lock);
+    filep->private_data = xf;
+
     jump(); /* in xoroshiro128plus.c */
 
     printk(KERN_INFO "XORO: %s opened. n_opens=%d\n", DEVICE_NAME, n_opens++);
@@ -162,8 +1350,11 @@ static int dev_open(struct inode *inodep, struct file *filep)
 }
 
 /** @brief Called whenever device is read from user space.
+ *         Times every sort of bench_sorts once on fresh input, unless one of
+ *         the other benchmark modes is set.
  *  @param filep Pointer to a file object (defined in linux/fs.h).
- *  @param buffer Pointer to the buffer to which this function may write data.
+ *  @param buffer Pointer to the buffer to which this function may write data:
+ *         the BENCH_SAMPLES times and flags of the sorts.
  *  @param len Number of bytes requested.
  *  @param offset Unused.
  *  @return Returns number of bytes successfully read. Negative on error.
@@ -173,244 +1364,142 @@ static ssize_t dev_read(struct file *filep,
                         size_t len,
                         loff_t *offset)
 {
-    preempt_disable();
-    /* Give at most 8 bytes per read */
-    ktime_t kt;
+    struct xoro_file *xf = filep->private_data;
+    struct ksort_sample sample;
     uint64_t *arr, *arr_copy;
-    uint64_t times[17];
-
-    arr = kmalloc_array(TEST_LEN, sizeof(*arr), GFP_KERNEL);
-    arr_copy = kmalloc_array(TEST_LEN, sizeof(*arr_copy), GFP_KERNEL);
-    for (size_t i = 0; i < TEST_LEN; ++i) {
-        uint64_t val = next();
-        arr[i] = val;
-    }
+    uint32_t *vals;
+    uint64_t samples[BENCH_SAMPLES];
+    size_t j;
+    const size_t n = bench_len ? bench_len : TEST_LEN;
 
-    /* kernel heap sort */
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    sort_heap(arr_copy, TEST_LEN, sizeof(*arr_copy), cmpint64, NULL);
-    kt = ktime_sub(ktime_get(), kt);
-    times[0] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in kernel heap sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_merge_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[1] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in merge sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_shell_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[2] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in shell sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_binary_insertion_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[3] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in binary insertion sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_heap_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[4] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in heap sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_quick_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[5] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in quick sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_selection_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[6] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in selection sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_tim_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[7] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in tim sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_bubble_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[8] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in bubble sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
-
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_bitonic_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[9] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in bitonic sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    /* The stream draws its input from the same generator */
+    if (READ_ONCE(xf->streamer))
+        return -EBUSY;
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_merge_sort_in_place(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[10] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in merge sort in place\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    if (bench_cpus && *bench_cpus)
+        return bench_on_cpus(buffer, len, n);
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_grail_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[11] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in grail sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    if (bench_sweep) {
+        uint64_t sweep[SWEEP_SAMPLES];
+        int err = bench_elem_sizes(sweep, n);
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_sqrt_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[12] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in sqrt sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+        if (err)
+            return err;
+        len = min(len, sizeof(sweep));
+        if (copy_to_user(buffer, sweep, len))
+            return -EFAULT;
+        return len;
+    }
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_rec_stable_sort(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[13] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in rec stable sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    if (bench_select) {
+        uint64_t select[SELECT_APIS];
+        int err = bench_select_apis(select, n);
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    ksort_grail_sort_dyn_buffer(arr_copy, TEST_LEN);
-    kt = ktime_sub(ktime_get(), kt);
-    times[14] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in grail sort dyn buffer\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+        if (err)
+            return err;
+        len = min(len, sizeof(select));
+        if (copy_to_user(buffer, select, len))
+            return -EFAULT;
+        return len;
+    }
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    sort_intro(arr_copy, TEST_LEN, sizeof(*arr_copy), cmpint64, 0);
-    kt = ktime_sub(ktime_get(), kt);
-    times[15] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in intro sort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    arr = kmalloc_array(n, sizeof(*arr), GFP_KERNEL);
+    arr_copy = kmalloc_array(n, sizeof(*arr_copy), GFP_KERNEL);
+    vals = kmalloc_array(n, sizeof(*vals), GFP_KERNEL);
+    if (!arr || !arr_copy || !vals) {
+        kfree(arr);
+        kfree(arr_copy);
+        kfree(vals);
+        return -ENOMEM;
+    }
+    fill_input(arr, n);
 
-    memcpy(arr_copy, arr, sizeof(uint64_t) * TEST_LEN);
-    kt = ktime_get();
-    sort_pdqsort(arr_copy, TEST_LEN, sizeof(*arr_copy), cmpuint64, 0);
-    kt = ktime_sub(ktime_get(), kt);
-    times[16] = ktime_to_ns(kt);
-    for (int i = 0; i < TEST_LEN - 1; i++)
-        if (arr_copy[i] > arr_copy[i + 1]) {
-            pr_err("test has failed in pdqsort\n");
-            break;
-        }
-    printk(KERN_INFO "%llu\n", ktime_to_ns(kt));
+    for (j = 0; j < ARRAY_SIZE(bench_sorts); j++) {
+        bench_time(j, arr, arr_copy, vals, n, false, &sample);
+        bench_check(j, arr, arr_copy, vals, n);
+        samples[j] = sample.ns;
+        samples[ARRAY_SIZE(bench_sorts) + j] = sample.flags;
+        printk(KERN_INFO "%llu\n", sample.ns);
+    }
 
     /* copy_to_user has the format ( * to, *from, size) and ret 0 on success */
-    int n_notcopied = copy_to_user(buffer, times, len);
+    len = min(len, sizeof(samples));
+    int n_notcopied = copy_to_user(buffer, samples, len);
     kfree(arr);
     kfree(arr_copy);
+    kfree(vals);
     if (0 != n_notcopied) {
         printk(KERN_ALERT "XORO: Failed to read %d/%ld bytes\n", n_notcopied,
                len);
         return -EFAULT;
     }
     printk(KERN_INFO "XORO: read %ld bytes\n", len);
-    preempt_enable();
     return len;
 }
 
+/** @brief ioctl() syscall: the asynchronous sort queue and the benchmark
+ *         sample stream of ksort.h.
+ *  @param filep Pointer to a file object (defined in linux/fs.h).
+ *  @param cmd One of the KSORT_IOC_* commands.
+ *  @param arg Pointer to the argument of the command.
+ *  @return Returns the result of the command. Negative on error.
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
+{
+    struct xoro_file *xf = filep->private_data;
+
+    switch (cmd) {
+    case KSORT_IOC_STREAM_START:
+        return stream_start(xf, u64_to_user_ptr(arg));
+    case KSORT_IOC_STREAM_STOP:
+        stream_stop(xf);
+        return 0;
+    default:
+        return ksort_async_ioctl(xf->async, cmd, arg);
+    }
+}
+
+/** @brief poll() syscall: readable while sort completions can be reaped.
+ *  @param filep Pointer to a file object (defined in linux/fs.h).
+ *  @param wait Poll table of the caller.
+ */
+static __poll_t dev_poll(struct file *filep, poll_table *wait)
+{
+    struct xoro_file *xf = filep->private_data;
+
+    return ksort_async_poll(xf->async, filep, wait);
+}
+
+/** @brief mmap() syscall: maps the sample ring of ksort.h.
+ *  @param filep Pointer to a file object (defined in linux/fs.h).
+ *  @param vma The mapping being created.
+ *  @return Returns 0 if successful. Negative on error.
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+    struct xoro_file *xf = filep->private_data;
+    int err;
+
+    mutex_lock(&xf->lock);
+    err = xoro_ring(xf);
+    if (!err)
+        err = ksort_ring_mmap(xf->ring, vma);
+    mutex_unlock(&xf->lock);
+    return err;
+}
+
 /** @brief Called when the userspace program calls close().
  *  @param inodep A pointer to an inode object (defined in linux/fs.h)
  *  @param filep A pointer to a file object (defined in linux/fs.h)
  */
 static int dev_release(struct inode *inodep, struct file *filep)
 {
+    struct xoro_file *xf = filep->private_data;
+
+    stream_stop(xf);
+    ksort_ring_destroy(xf->ring);
+    ksort_async_destroy(xf->async);
+    kfree(xf);
     mutex_unlock(&xoroshiro128p_mutex);
     return 0;
 }
@@ -1,31 +1,54 @@
 import numpy as np
 
-def outlier_filter(datas, threshold = 1):
+percentiles = [50, 90, 99]
+
+# Samples are never replaced or dropped by their value: the tail is real
+# behaviour of the sorts.  The only samples left out of the clean
+# distribution are the ones the kernel saw disturbed by an interrupt, a
+# softirq or a context switch ("./benchmark" and "./benchmark stream" print
+# these tags after the times; output without them counts as clean).
+def split_samples(datas, num_case):
     datas = np.array(datas)
-    z = np.abs((datas - datas.mean(axis = 0)) / datas.std(axis = 0))
-    m = datas.mean(axis = 0)
-    
-    for i in m:
-        print("{:.0f}".format(i))
+    times = datas[:, :num_case]
+    if datas.shape[1] >= 2 * num_case:
+        disturbed = datas[:, num_case:2 * num_case] != 0
+    else:
+        disturbed = np.zeros(times.shape, dtype=bool)
+    return times, disturbed
 
-    # TODO: maybe use numpy function
-    for i in range(z.shape[0]):
-        for j in range(z.shape[1]):
-            if z[i, j] > threshold:
-                datas[i, j] = m[j]
-    return datas
+def summary(samples):
+    if len(samples) == 0:
+        return ['-'] * (len(percentiles) + 2)
+    p = np.percentile(samples, percentiles)
+    return ["{:.0f}".format(e) for e in [samples.mean(), *p, samples.max()]]
 
 if __name__ == '__main__':
-    f = open('out.txt', 'r+')
+    f = open('out.txt', 'r')
     lines = f.readlines()
-    num_case = len(lines[0].split())
-    
+    f.close()
+
+    # "./benchmark" and "./benchmark stream" start with a "# " line naming
+    # the sorts; without it, every row is taken as times followed by tags
+    names = None
     datas = []
     for line in lines:
+        if line.startswith('#'):
+            names = names or line[1:].split()
+            continue
         _list = [int(e) for e in line.split()]
         datas.append(_list)
-    
-    datas = outlier_filter(datas)
+    if names is None:
+        names = ['sort{}'.format(j) for j in range(len(datas[0]) // 2)]
+    num_case = len(names)
 
-    np.savetxt('out.txt', datas, fmt='%d')
-    f.close()
+    times, disturbed = split_samples(datas, num_case)
+
+    stats = ['mean'] + ['p{}'.format(p) for p in percentiles] + ['max']
+    print('{:<22} {:>9} {}'.format('sort', 'disturbed',
+          ' '.join('{:>10}'.format(kind + '_' + s)
+                   for kind in ('raw', 'clean') for s in stats)))
+    for j in range(num_case):
+        raw = summary(times[:, j])
+        clean = summary(times[~disturbed[:, j], j])
+        print('{:<22} {:>9} {}'.format(names[j], disturbed[:, j].sum(),
+              ' '.join('{:>10}'.format(e) for e in raw + clean)))
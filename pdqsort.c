@@ -15,16 +15,24 @@
     3. This notice may not be removed or altered from any source distribution.
 */
 
+#include <linux/bug.h>
 #include <linux/compiler.h>
 #include <linux/limits.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
+#include <linux/timex.h>
 #include <linux/types.h>
 
+#include "ksort_trace.h"
+#include "profile.h"
 #include "sort_impl.h"
 
-#define insertion_sort_threshold 24
-#define ninther_threshold 128
-#define partial_insertion_sort_limit 8
+/* Tuning thresholds, see sort_impl.h */
+#define insertion_sort_threshold READ_ONCE(ksort_pdq_insertion_threshold)
+#define ninther_threshold READ_ONCE(ksort_pdq_ninther_threshold)
+#define partial_insertion_sort_limit \
+    READ_ONCE(ksort_pdq_partial_insertion_limit)
 
 #define idx(x) (x) * size
 
@@ -37,15 +45,27 @@ static inline int __log2(size_t x)
     return 63 - __builtin_clzll(x);
 }
 
-static int cmpint64(const void *a, const void *b)
+/**
+ * is_aligned - is this pointer & size okay for word-wide copying?
+ * @base: pointer to data
+ * @size: size of each element
+ * @align: required alignment (typically 4 or 8)
+ *
+ * Returns true if elements can be copied using word loads and stores.
+ * The size must be a multiple of the alignment, and the base address must
+ * be if we do not have CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS.
+ */
+__attribute_const__ __always_inline static bool is_aligned(const void *base,
+                                                           size_t size,
+                                                           unsigned char align)
 {
-    uint64_t a_val = *(uint64_t *) a;
-    uint64_t b_val = *(uint64_t *) b;
-    if (a_val > b_val)
-        return 1;
-    if (a_val == b_val)
-        return 0;
-    return -1;
+    unsigned char lsbits = (unsigned char) size;
+
+    (void) base;
+#ifndef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+    lsbits |= (unsigned char) (uintptr_t) base;
+#endif
+    return (lsbits & (align - 1)) == 0;
 }
 
 /**
@@ -143,17 +163,32 @@ static void swap_bytes(void *a, void *b, size_t n)
 /*
  * The function pointer is last to make tail calls most efficient if the
  * compiler decides not to inline this function.
+ *
+ * The sorting code passes 0 (SWAP_WORDS_64) for the built-in swap, so that
+ * case falls back to narrower chunks when the element size or the addresses
+ * don't allow 64-bit ones.
  */
-static void do_swap(void *a, void *b, size_t size, swap_func_t swap_func)
+__always_inline static void do_swap(void *a,
+                                    void *b,
+                                    size_t size,
+                                    swap_func_t swap_func)
 {
-    if (swap_func == SWAP_WORDS_64)
-        swap_words_64(a, b, size);
-    else if (swap_func == SWAP_WORDS_32)
+    if (swap_func == SWAP_WORDS_64) {
+        const void *ab = (const void *) ((uintptr_t) a | (uintptr_t) b);
+
+        if (is_aligned(ab, size, 8))
+            swap_words_64(a, b, size);
+        else if (is_aligned(ab, size, 4))
+            swap_words_32(a, b, size);
+        else
+            swap_bytes(a, b, size);
+    } else if (swap_func == SWAP_WORDS_32) {
         swap_words_32(a, b, size);
-    else if (swap_func == SWAP_BYTES)
+    } else if (swap_func == SWAP_BYTES) {
         swap_bytes(a, b, size);
-    else
+    } else {
         swap_func(a, b, (int) size);
+    }
 }
 
 #if 0
@@ -167,7 +202,10 @@ static void print(void *_begin, void *_end, size_t size)
 }
 #endif
 
-void insertion_sort(void *_begin, void *_end, size_t size, cmp_func_t cmp_func)
+__always_inline static void insertion_sort(void *_begin,
+                                           void *_end,
+                                           size_t size,
+                                           cmp_func_t cmp_func)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
@@ -188,10 +226,10 @@ void insertion_sort(void *_begin, void *_end, size_t size, cmp_func_t cmp_func)
     }
 }
 
-void unguarded_insertion_sort(void *_begin,
-                              void *_end,
-                              size_t size,
-                              cmp_func_t cmp_func)
+__always_inline static void unguarded_insertion_sort(void *_begin,
+                                                     void *_end,
+                                                     size_t size,
+                                                     cmp_func_t cmp_func)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
@@ -212,13 +250,14 @@ void unguarded_insertion_sort(void *_begin,
     }
 }
 
-static bool partial_insertion_sort(void *_begin,
-                                   void *_end,
-                                   size_t size,
-                                   cmp_func_t cmp_func)
+__always_inline static bool partial_insertion_sort(void *_begin,
+                                                   void *_end,
+                                                   size_t size,
+                                                   cmp_func_t cmp_func)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
+    const size_t max_limit = partial_insertion_sort_limit;
 
     if (begin == end)
         return true;
@@ -237,26 +276,100 @@ static bool partial_insertion_sort(void *_begin,
             limit += (cur - sift) / size;
         }
 
-        if (limit > partial_insertion_sort_limit)
+        if (limit > max_limit)
             return false;
     }
 
     return true;
 }
 
-static void sort2(void *a, void *b, size_t size, cmp_func_t cmp_func)
+__always_inline static void sort2(void *a,
+                                  void *b,
+                                  size_t size,
+                                  cmp_func_t cmp_func)
 {
     if (cmp_func(b, a))
         do_swap(a, b, size, 0);
 }
 
-static void sort3(void *a, void *b, void *c, size_t size, cmp_func_t cmp_func)
+__always_inline static void sort3(void *a,
+                                  void *b,
+                                  void *c,
+                                  size_t size,
+                                  cmp_func_t cmp_func)
 {
     sort2(a, b, size, cmp_func);
     sort2(b, c, size, cmp_func);
     sort2(a, b, size, cmp_func);
 }
 
+/*
+ * Move the pivot to *begin: the median of the first, middle and last element,
+ * or above ninther_threshold elements Tukey's ninther, the median of three
+ * such medians.
+ */
+__always_inline static void choose_pivot(char *begin,
+                                         char *end,
+                                         size_t size,
+                                         cmp_func_t cmp_func)
+{
+    size_t num = (end - begin) / size;
+    size_t m = num / 2;
+
+    if (num > ninther_threshold) {
+        sort3(begin, begin + idx(m), end - idx(1), size, cmp_func);
+        sort3(begin + idx(1), begin + idx(m - 1), end - idx(2), size,
+              cmp_func);
+        sort3(begin + idx(2), begin + idx(m + 1), end - idx(3), size,
+              cmp_func);
+        sort3(begin + idx(m - 1), begin + idx(m), begin + idx(m + 1), size,
+              cmp_func);
+        do_swap(begin, begin + idx(m), size, 0);
+    } else {
+        sort3(begin + idx(m), begin, end - idx(1), size, cmp_func);
+    }
+}
+
+__always_inline static void sift_down(char *begin,
+                                      size_t root,
+                                      size_t num,
+                                      size_t size,
+                                      cmp_func_t cmp_func)
+{
+    size_t child;
+
+    while ((child = 2 * root + 1) < num) {
+        if (child + 1 < num &&
+            cmp_func(begin + idx(child), begin + idx(child + 1)))
+            child++;
+        if (!cmp_func(begin + idx(root), begin + idx(child)))
+            return;
+        do_swap(begin + idx(root), begin + idx(child), size, 0);
+        root = child;
+    }
+}
+
+/*
+ * Heapsort [begin, end), the fallback once too many partitions turned out
+ * highly unbalanced.  It needs neither recursion nor extra memory.
+ */
+__always_inline static void heap_sort(char *begin,
+                                      char *end,
+                                      size_t size,
+                                      cmp_func_t cmp_func)
+{
+    size_t num = (end - begin) / size;
+    size_t i;
+
+    for (i = num / 2; i-- > 0;)
+        sift_down(begin, i, num, size, cmp_func);
+
+    for (i = num; i-- > 1;) {
+        do_swap(begin, begin + idx(i), size, 0);
+        sift_down(begin, 0, i, size, cmp_func);
+    }
+}
+
 #if 0
 static void swap_offsets(char *first,
                          char *last,
@@ -453,11 +566,11 @@ static bool partition_right_branchless(void *_begin,
 }
 #endif
 
-static bool partition_right(void *_begin,
-                            void *_end,
-                            size_t size,
-                            cmp_func_t cmp_func,
-                            char **ret_pivot)
+__always_inline static bool partition_right(void *_begin,
+                                            void *_end,
+                                            size_t size,
+                                            cmp_func_t cmp_func,
+                                            char **ret_pivot)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
@@ -492,10 +605,10 @@ static bool partition_right(void *_begin,
     return already_partitioned;
 }
 
-static char *partition_left(void *_begin,
-                            void *_end,
-                            size_t size,
-                            cmp_func_t cmp_func)
+__always_inline static char *partition_left(void *_begin,
+                                            void *_end,
+                                            size_t size,
+                                            cmp_func_t cmp_func)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
@@ -526,111 +639,107 @@ static char *partition_left(void *_begin,
     return last;
 }
 
-static void pdqsort_loop(void *_begin,
-                         void *_end,
-                         size_t size,
-                         cmp_func_t cmp_func,
-                         size_t max_depth,
-                         bool leftmost)
+typedef void (*pdqsort_loop_t)(void *begin,
+                               void *end,
+                               size_t size,
+                               cmp_func_t cmp_func);
+
+/* A partition waiting on the explicit stack of __pdqsort_loop() */
+typedef struct {
+    char *begin, *end;
+    size_t max_depth;
+    bool leftmost;
+} pdq_range_t;
+
+/*
+ * The sorting loop itself.  It is instantiated once per specialized element
+ * size below, so @size is a constant in each copy.
+ *
+ * Instead of recursing, each partition step continues with the smaller side
+ * and pushes the larger one.  The range being sorted while k partitions are
+ * pushed then holds at most num / 2^k elements, so the stack never holds
+ * more than log2(num) of them: under a kilobyte of heap even for 10^8
+ * elements, and a constant, small kernel stack frame.  If the stack can't
+ * be allocated, the whole range is heapsorted instead.  Cooperative mode
+ * checkpoints before partitioning ranges of KSORT_CHECKPOINT_MIN or more.
+ */
+__always_inline static void __pdqsort_loop(void *_begin,
+                                           void *_end,
+                                           size_t size,
+                                           cmp_func_t cmp_func)
 {
     char *begin = (char *) _begin;
     char *end = (char *) _end;
+    size_t num = (end - begin) / size;
+    size_t max_depth, stack_size, top = 0;
+    bool leftmost = true;
+    pdq_range_t *stack;
+
+    if (num < insertion_sort_threshold) {
+        ksort_profile_begin(KSORT_PHASE_SMALL);
+        insertion_sort(begin, end, size, cmp_func);
+        ksort_profile_end(KSORT_PHASE_SMALL);
+        return;
+    }
+
+    max_depth = stack_size = __log2(num);
+    ksort_profile_begin(KSORT_PHASE_ALLOC);
+    stack = kmalloc_array(stack_size, sizeof(*stack), GFP_KERNEL);
+    ksort_profile_end(KSORT_PHASE_ALLOC);
+    if (!stack) {
+        trace_ksort_heap_fallback(KSORT_ALGO_PDQSORT, num);
+        ksort_profile_begin(KSORT_PHASE_HEAP);
+        heap_sort(begin, end, size, cmp_func);
+        ksort_profile_end(KSORT_PHASE_HEAP);
+        return;
+    }
+
     while (true) {
-        size_t num = (end - begin) / size;
+        num = (end - begin) / size;
 
         if (num < insertion_sort_threshold) {
+            ksort_profile_begin(KSORT_PHASE_SMALL);
             if (leftmost)
                 insertion_sort(begin, end, size, cmp_func);
             else
                 unguarded_insertion_sort(begin, end, size, cmp_func);
-            return;
-        }
-        size_t m = num / 2;
-        if (num > ninther_threshold) {
-            sort3(begin, begin + idx(m), end - idx(1), size, cmp_func);
-            sort3(begin + idx(1), begin + idx(m - 1), end - idx(2), size,
-                  cmp_func);
-            sort3(begin + idx(2), begin + idx(m + 1), end - idx(3), size,
-                  cmp_func);
-            sort3(begin + idx(m - 1), begin + idx(m), begin + idx(m + 1), size,
-                  cmp_func);
-            do_swap(begin, begin + idx(m), size, 0);
-        } else {
-            sort3(begin, begin + idx(m), end - idx(1), size, cmp_func);
+            ksort_profile_end(KSORT_PHASE_SMALL);
+            goto pop;
         }
+        if (num >= KSORT_CHECKPOINT_MIN)
+            ksort_checkpoint();
+        ksort_profile_begin(KSORT_PHASE_PIVOT);
+        choose_pivot(begin, end, size, cmp_func);
+        ksort_profile_end(KSORT_PHASE_PIVOT);
         if (!leftmost && !cmp_func(begin - idx(1), begin)) {
-            begin = partition_left(begin, end, size, cmp_func) + idx(1);
+            ksort_profile_begin(KSORT_PHASE_PARTITION);
+            char *p = partition_left(begin, end, size, cmp_func);
+            ksort_profile_end(KSORT_PHASE_PARTITION);
+
+            trace_ksort_partition(KSORT_ALGO_PDQSORT, num, (p - begin) / size);
+            begin = p + idx(1);
             continue;
         }
         char *pivot;
+        ksort_profile_begin(KSORT_PHASE_PARTITION);
         bool already_partitioned =
             partition_right(begin, end, size, cmp_func, &pivot);
+        ksort_profile_end(KSORT_PHASE_PARTITION);
 
         size_t l_size = (pivot - begin) / size;
         size_t r_size = (end - (pivot + idx(1))) / size;
         bool highly_unbalanced = l_size < num / 8 || r_size < num / 8;
 
+        trace_ksort_partition(KSORT_ALGO_PDQSORT, num, l_size);
         if (likely(highly_unbalanced)) {
             if (--max_depth == 0) {
-                size_t part_length = (size_t)((end - begin) / size);
-                if (part_length > 0) {
-                    size_t i, j, k = part_length >> 1;
-                    char *tmp = kmalloc(size, GFP_KERNEL);
-                    /* heapification */
-                    do {
-                        i = k;
-                        j = (i << 1) + 2;
-                        memcpy(tmp, begin + idx(i), size);
-
-                        while (j <= part_length) {
-                            if (j < part_length)
-                                j += (cmpint64(begin + idx(j),
-                                               begin + idx(j + 1)) < 0);
-                            if (cmpint64(begin + idx(j), tmp) <= 0)
-                                break;
-                            memcpy(begin + idx(i), begin + idx(j), size);
-                            i = j;
-                            j = (i << 1) + 2;
-                        }
-
-                        memcpy(begin + idx(i), tmp, size);
-                    } while (k-- > 0);
-
-                    /* heapsort */
-                    do {
-                        i = part_length;
-                        j = 0;
-                        memcpy(tmp, begin + idx(part_length), size);
-
-                        /* Floyd's optimization:
-                         * Not checking low[j] <= tmp saves nlog2(n) comparisons
-                         */
-                        while (j < part_length) {
-                            if (j < part_length - 1)
-                                j += (cmpint64(begin + idx(j),
-                                               begin + idx(j + 1)) < 0);
-                            memcpy(begin + idx(i), begin + idx(j), size);
-                            i = j;
-                            j = (i << 1) + 2;
-                        }
-
-                        /* Compensate for Floyd's optimization by sifting down
-                         * tmp. This adds O(n) comparisons and moves.
-                         */
-                        while (i > 1) {
-                            j = (i - 2) >> 1;
-                            if (cmpint64(tmp, begin + idx(j)) <= 0)
-                                break;
-                            memcpy(begin + idx(i), begin + idx(j), size);
-                            i = j;
-                        }
-
-                        memcpy(begin + idx(i), tmp, size);
-                    } while (part_length-- > 0);
-                    kfree(tmp);
-                }
-                return;
+                trace_ksort_heap_fallback(KSORT_ALGO_PDQSORT, num);
+                ksort_profile_begin(KSORT_PHASE_HEAP);
+                heap_sort(begin, end, size, cmp_func);
+                ksort_profile_end(KSORT_PHASE_HEAP);
+                goto pop;
             }
+            trace_ksort_pdq_shuffle(num, l_size, r_size);
             if (l_size >= insertion_sort_threshold) {
                 do_swap(begin, begin + idx(l_size / 4), size, 0);
                 do_swap(pivot - idx(1), pivot - idx(l_size / 4), size, 0);
@@ -661,16 +770,77 @@ static void pdqsort_loop(void *_begin,
                 }
             }
         } else {
+            ksort_profile_begin(KSORT_PHASE_SMALL);
             if (already_partitioned &&
                 partial_insertion_sort(begin, pivot, size, cmp_func) &&
                 partial_insertion_sort(pivot + idx(1), end, size, cmp_func)) {
-                return;
+                ksort_profile_end(KSORT_PHASE_SMALL);
+                goto pop;
             }
+            ksort_profile_end(KSORT_PHASE_SMALL);
+        }
+
+        /* Push the larger side, sort the smaller one next */
+        pdq_range_t larger;
+        if (l_size > r_size) {
+            larger = (pdq_range_t){begin, pivot, max_depth, leftmost};
+            begin = pivot + idx(1);
+            leftmost = false;
+        } else {
+            larger = (pdq_range_t){pivot + idx(1), end, max_depth, false};
+            end = pivot;
         }
+        /* Can't trigger: the range halves with every push */
+        if (WARN_ON_ONCE(top >= stack_size))
+            heap_sort(larger.begin, larger.end, size, cmp_func);
+        else
+            stack[top++] = larger;
+        continue;
+
+    pop:
+        if (!top)
+            break;
+        top--;
+        begin = stack[top].begin;
+        end = stack[top].end;
+        max_depth = stack[top].max_depth;
+        leftmost = stack[top].leftmost;
+    }
+
+    kfree(stack);
+}
+
+#define PDQSORT_LOOP(name, elem_size)                                          \
+    static void name(void *begin, void *end, size_t size, cmp_func_t cmp_func) \
+    {                                                                          \
+        __pdqsort_loop(begin, end, elem_size, cmp_func);                       \
+    }
 
-        pdqsort_loop(begin, pivot, size, cmp_func, max_depth, leftmost);
-        begin = pivot + idx(1);
-        leftmost = false;
+PDQSORT_LOOP(pdqsort_loop, size)
+PDQSORT_LOOP(pdqsort_loop_4, 4)
+PDQSORT_LOOP(pdqsort_loop_8, 8)
+PDQSORT_LOOP(pdqsort_loop_12, 12)
+PDQSORT_LOOP(pdqsort_loop_16, 16)
+PDQSORT_LOOP(pdqsort_loop_32, 32)
+
+static pdqsort_loop_t choose_loop(size_t size)
+{
+    if (!ksort_specialize)
+        return pdqsort_loop;
+
+    switch (size) {
+    case 4:
+        return pdqsort_loop_4;
+    case 8:
+        return pdqsort_loop_8;
+    case 12:
+        return pdqsort_loop_12;
+    case 16:
+        return pdqsort_loop_16;
+    case 32:
+        return pdqsort_loop_32;
+    default:
+        return pdqsort_loop;
     }
 }
 
@@ -680,6 +850,76 @@ void sort_pdqsort(void *base,
                   cmp_func_t cmp_func,
                   swap_func_t swap_func)
 {
-    pdqsort_loop(base, (char *) base + idx(num), size, cmp_func, __log2(num),
-                 true);
+    if (!swap_func && size >= KSORT_INDIRECT_MIN_SIZE &&
+        !ksort_indirect_less(base, num, size, cmp_func, NULL))
+        return;
+
+    choose_loop(size)(base, (char *) base + idx(num), size, cmp_func);
+}
+
+void ksort_select(void *base,
+                  size_t num,
+                  size_t size,
+                  size_t k,
+                  cmp_func_t cmp_func)
+{
+    char *begin = (char *) base;
+    char *end = begin + idx(num);
+    char *kth = begin + idx(k);
+
+    if (k >= num)
+        return;
+
+    int bad_allowed = __log2(num);
+    while ((size_t)(end - begin) / size >= insertion_sort_threshold) {
+        size_t part = (end - begin) / size;
+        char *pivot;
+
+        choose_pivot(begin, end, size, cmp_func);
+
+        /* The pivot equals the element bounding this range from the left,
+         * so no element is smaller: split off everything equal to it. */
+        if (begin != (char *) base && !cmp_func(begin - idx(1), begin)) {
+            pivot = partition_left(begin, end, size, cmp_func);
+            if (kth <= pivot)
+                return;
+            begin = pivot + idx(1);
+            continue;
+        }
+
+        partition_right(begin, end, size, cmp_func, &pivot);
+
+        size_t l_size = (pivot - begin) / size;
+        size_t r_size = (end - (pivot + idx(1))) / size;
+        if ((l_size < part / 8 || r_size < part / 8) && --bad_allowed == 0) {
+            trace_ksort_heap_fallback(KSORT_ALGO_PDQSORT, part);
+            heap_sort(begin, end, size, cmp_func);
+            return;
+        }
+
+        if (kth == pivot)
+            return;
+        if (kth < pivot)
+            end = pivot;
+        else
+            begin = pivot + idx(1);
+    }
+
+    insertion_sort(begin, end, size, cmp_func);
+}
+
+void ksort_partial_sort(void *base,
+                        size_t num,
+                        size_t size,
+                        size_t k,
+                        cmp_func_t cmp_func,
+                        swap_func_t swap_func)
+{
+    if (k == 0)
+        return;
+    if (k < num)
+        ksort_select(base, num, size, k - 1, cmp_func);
+    else
+        k = num;
+    sort_pdqsort(base, k, size, cmp_func, swap_func);
 }
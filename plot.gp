@@ -21,4 +21,13 @@ plot [][] 'out.txt' using 1 with linespoints linewidth 1 title 'kernel heap sort
 '' using 14 with linespoints linewidth 1 title 'rec stable sort', \
 '' using 15 with linespoints linewidth 1 title 'grail sort dyn buffer', \
 '' using 16 with linespoints linewidth 1 title 'intro sort', \
-'' using 17 with linespoints linewidth 1 title 'pattern-defeating quicksort'
\ No newline at end of file
+'' using 17 with linespoints linewidth 1 title 'pattern-defeating quicksort', \
+'' using 18 with linespoints linewidth 1 title 'power sort', \
+'' using 19 with linespoints linewidth 1 title 'bottom-up merge sort', \
+'' using 20 with linespoints linewidth 1 title 'radix sort', \
+'' using 21 with linespoints linewidth 1 title 'auto sort', \
+'' using 22 with linespoints linewidth 1 title 'kv quick sort', \
+'' using 23 with linespoints linewidth 1 title 'kv merge sort', \
+'' using 24 with linespoints linewidth 1 title 'kv radix sort', \
+'' using 25 with linespoints linewidth 1 title 'weak heap sort', \
+'' using 26 with linespoints linewidth 1 title 'smooth sort'
\ No newline at end of file
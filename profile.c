@@ -0,0 +1,170 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Phase breakdown of the benchmark sorts, in profiling builds
+ *
+ * Built only with KSORT_PROFILE (make PROFILE=1).  The engines then mark
+ * pivot selection, partitioning, small-range insertion sorts, merges, heap
+ * fallbacks and allocations with ksort_profile_begin() and
+ * ksort_profile_end(), which add the cycles of each step to a per-CPU
+ * counter of its phase.  The benchmark snapshots the counters of its CPU
+ * around every sort in bench_time() and hands the difference to
+ * ksort_profile_record(), which sums it per benchmark column along with the
+ * cycles of the whole sort.  That covers read(), the sample stream and the
+ * threads of bench_cpus.
+ *
+ * /sys/kernel/debug/ksort/phases shows, for every column that ran, the
+ * number of sorts recorded and the mean cycles per sort: in total, in each
+ * phase, and in none of them (other).  other is what a tuning change outside
+ * the phases would have to win back: run detection, pdqsort's pattern
+ * breaking, the sorts and engines that aren't marked at all, and the stamps
+ * themselves.  Writing anything to the file zeroes it.
+ *
+ * Every step costs two get_cycles() and three this_cpu operations, so a
+ * profiling build is slower, mostly in the small-range phase where the steps
+ * are shortest.  Compare the split between phases, not the totals with those
+ * of a normal build.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+#include <linux/timex.h>
+#include <linux/types.h>
+
+#include "hist.h"
+#include "profile.h"
+
+DEFINE_PER_CPU(struct ksort_phases, ksort_phases);
+DEFINE_PER_CPU(struct ksort_phases, ksort_phase_stamps);
+
+struct profile_row {
+    u64 sorts;
+    u64 cycles;
+    u64 phases[KSORT_PHASES];
+};
+
+static DEFINE_PER_CPU(struct profile_row[KSORT_PROFILE_SORTS], profile_rows);
+
+static const char *const profile_phases[KSORT_PHASES] = {
+    [KSORT_PHASE_PIVOT] = "pivot",
+    [KSORT_PHASE_PARTITION] = "partition",
+    [KSORT_PHASE_SMALL] = "small",
+    [KSORT_PHASE_MERGE] = "merge",
+    [KSORT_PHASE_HEAP] = "heap",
+    [KSORT_PHASE_ALLOC] = "alloc",
+};
+
+/**
+ * ksort_profile_snap - copy the phase counters of the current CPU
+ * @phases: receives the counters
+ */
+void ksort_profile_snap(struct ksort_phases *phases)
+{
+    memcpy(phases, raw_cpu_ptr(&ksort_phases), sizeof(*phases));
+}
+
+/**
+ * ksort_profile_record - add a benchmark sort to its column
+ * @sort: column of the sort in the results of read()
+ * @cycles: cycles of the whole sort
+ * @before: counters snapshot before the sort
+ * @after: counters snapshot after it, on the same CPU
+ */
+void ksort_profile_record(unsigned int sort,
+                          u64 cycles,
+                          const struct ksort_phases *before,
+                          const struct ksort_phases *after)
+{
+    unsigned int p;
+
+    if (sort >= KSORT_PROFILE_SORTS)
+        return;
+    this_cpu_inc(profile_rows[sort].sorts);
+    this_cpu_add(profile_rows[sort].cycles, cycles);
+    for (p = 0; p < KSORT_PHASES; p++)
+        this_cpu_add(profile_rows[sort].phases[p],
+                     after->cycles[p] - before->cycles[p]);
+}
+
+static int phases_show(struct seq_file *m, void *v)
+{
+    unsigned int s, p;
+    int cpu;
+
+    seq_puts(m, "# column sorts cycles");
+    for (p = 0; p < KSORT_PHASES; p++)
+        seq_printf(m, " %s", profile_phases[p]);
+    seq_puts(m, " other\n");
+
+    for (s = 0; s < KSORT_PROFILE_SORTS; s++) {
+        struct profile_row sum = {0};
+        u64 phased = 0;
+
+        for_each_possible_cpu (cpu) {
+            const struct profile_row *r = &per_cpu(profile_rows, cpu)[s];
+
+            sum.sorts += r->sorts;
+            sum.cycles += r->cycles;
+            for (p = 0; p < KSORT_PHASES; p++)
+                sum.phases[p] += r->phases[p];
+        }
+        if (!sum.sorts)
+            continue;
+
+        seq_printf(m, "%u %llu %llu", s, sum.sorts,
+                   div64_u64(sum.cycles, sum.sorts));
+        for (p = 0; p < KSORT_PHASES; p++) {
+            seq_printf(m, " %llu", div64_u64(sum.phases[p], sum.sorts));
+            phased += sum.phases[p];
+        }
+        /* In cooperative mode, sorts of other tasks that preempt the
+         * benchmark add to the phases as well and can push them past the
+         * total */
+        seq_printf(m, " %llu\n",
+                   div64_u64(sum.cycles - min(phased, sum.cycles), sum.sorts));
+    }
+    return 0;
+}
+
+static int phases_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, phases_show, inode->i_private);
+}
+
+static ssize_t phases_write(struct file *file,
+                            const char __user *buf,
+                            size_t count,
+                            loff_t *ppos)
+{
+    int cpu;
+
+    for_each_possible_cpu (cpu)
+        memset(per_cpu(profile_rows, cpu), 0,
+               sizeof(per_cpu(profile_rows, cpu)));
+    return count;
+}
+
+static const struct file_operations phases_fops = {
+    .owner = THIS_MODULE,
+    .open = phases_open,
+    .read = seq_read,
+    .write = phases_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/**
+ * ksort_profile_init - create the debugfs file of the breakdown
+ *
+ * Called after ksort_hist_init(), whose ksort_hist_exit() removes the file
+ * again with the rest of the directory.
+ */
+void ksort_profile_init(void)
+{
+    debugfs_create_file("phases", 0644, ksort_debugfs, NULL, &phases_fops);
+}
@@ -0,0 +1,77 @@
+#ifndef KSORT_PROFILE_H
+#define KSORT_PROFILE_H
+
+/*
+ * Phase profiling, compiled in only with KSORT_PROFILE (make PROFILE=1).
+ * The engines mark each step of a sort with ksort_profile_begin() and
+ * ksort_profile_end(), which stamp get_cycles() and add the difference to
+ * the counter of its phase on the current CPU; the benchmark reads the
+ * counters around every sort and exports the breakdown in debugfs, see
+ * profile.c.  Steps of one phase never nest, and every path out of a step
+ * ends it.  A step that moves to another CPU finds no stamp there and is
+ * not counted.  Without KSORT_PROFILE, the marks and the other calls do
+ * nothing.  Includers need <linux/percpu.h> and <linux/timex.h>.
+ */
+enum ksort_phase {
+    KSORT_PHASE_PIVOT,     /* choosing pivots */
+    KSORT_PHASE_PARTITION, /* partitioning around them */
+    KSORT_PHASE_SMALL,     /* insertion sorts of small ranges and runs */
+    KSORT_PHASE_MERGE,     /* merging sorted runs */
+    KSORT_PHASE_HEAP,      /* heapsort fallbacks of partitioning sorts */
+    KSORT_PHASE_ALLOC,     /* allocating stacks and buffers */
+    KSORT_PHASES
+};
+
+struct ksort_phases {
+    u64 cycles[KSORT_PHASES];
+};
+
+#define KSORT_PROFILE_SORTS 32 /* benchmark columns that are recorded */
+
+#ifdef KSORT_PROFILE
+DECLARE_PER_CPU(struct ksort_phases, ksort_phases);
+DECLARE_PER_CPU(struct ksort_phases, ksort_phase_stamps);
+
+#define ksort_profile_begin(phase)                                      \
+    do {                                                                \
+        this_cpu_write(ksort_phase_stamps.cycles[phase], get_cycles()); \
+    } while (0)
+
+#define ksort_profile_end(phase)                                        \
+    do {                                                                \
+        const u64 __ksort_stamp =                                       \
+            this_cpu_xchg(ksort_phase_stamps.cycles[phase], 0);         \
+                                                                        \
+        if (__ksort_stamp)                                              \
+            this_cpu_add(ksort_phases.cycles[phase],                    \
+                         get_cycles() - __ksort_stamp);                 \
+    } while (0)
+
+extern void ksort_profile_init(void);
+
+extern void ksort_profile_snap(struct ksort_phases *phases);
+extern void ksort_profile_record(unsigned int sort,
+                                 u64 cycles,
+                                 const struct ksort_phases *before,
+                                 const struct ksort_phases *after);
+#else
+#define ksort_profile_begin(phase) \
+    do {                           \
+    } while (0)
+
+#define ksort_profile_end(phase) \
+    do {                         \
+    } while (0)
+
+static inline void ksort_profile_init(void) {}
+
+static inline void ksort_profile_snap(struct ksort_phases *phases) {}
+static inline void ksort_profile_record(unsigned int sort,
+                                        u64 cycles,
+                                        const struct ksort_phases *before,
+                                        const struct ksort_phases *after)
+{
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared-memory ring of benchmark samples, see ksort.h for the layout
+ *
+ * The ring lives in vmalloc_user() memory mapped into the reader.  Apart
+ * from the indices, nothing the kernel relies on is kept there: userspace
+ * can write the whole mapping, so the slot mask stays in struct ksort_ring
+ * and a bogus tail can at worst make the producer overwrite samples that
+ * were not read yet, or wait.
+ */
+
+#include <linux/compiler.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/vmalloc.h>
+
+#include <asm/barrier.h>
+
+#include "ksort.h"
+#include "ring.h"
+
+struct ksort_ring {
+    struct ksort_ring_hdr *hdr;
+    struct ksort_sample *samples;
+    u32 head; /* private copy, hdr->head is only ever written */
+};
+
+struct ksort_ring *ksort_ring_create(void)
+{
+    struct ksort_ring *ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+
+    if (!ring)
+        return NULL;
+    ring->hdr = vmalloc_user(KSORT_RING_SIZE);
+    if (!ring->hdr) {
+        kfree(ring);
+        return NULL;
+    }
+    ring->samples = (void *) ring->hdr + KSORT_RING_SAMPLES;
+    return ring;
+}
+
+void ksort_ring_destroy(struct ksort_ring *ring)
+{
+    if (!ring)
+        return;
+    vfree(ring->hdr);
+    kfree(ring);
+}
+
+/* Empty the ring for a new stream; nothing may be pushing */
+void ksort_ring_reset(struct ksort_ring *ring)
+{
+    ring->head = 0;
+    WRITE_ONCE(ring->hdr->tail, 0);
+    WRITE_ONCE(ring->hdr->done, 0);
+    smp_store_release(&ring->hdr->head, 0);
+}
+
+/**
+ * ksort_ring_push - publish one sample
+ * @ring: the ring
+ * @sample: sample to copy in
+ *
+ * Returns false, without blocking, if the ring is full.
+ */
+bool ksort_ring_push(struct ksort_ring *ring,
+                     const struct ksort_sample *sample)
+{
+    const u32 head = ring->head;
+
+    if (head - smp_load_acquire(&ring->hdr->tail) >= KSORT_RING_ENTRIES)
+        return false;
+
+    ring->samples[head & (KSORT_RING_ENTRIES - 1)] = *sample;
+    ring->head = head + 1;
+    smp_store_release(&ring->hdr->head, ring->head);
+    return true;
+}
+
+/* Tell the reader that no more samples will come */
+void ksort_ring_finish(struct ksort_ring *ring)
+{
+    smp_store_release(&ring->hdr->done, 1);
+}
+
+int ksort_ring_mmap(struct ksort_ring *ring, struct vm_area_struct *vma)
+{
+    return remap_vmalloc_range(vma, ring->hdr, vma->vm_pgoff);
+}
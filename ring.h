@@ -0,0 +1,23 @@
+#ifndef KSORT_RING_H
+#define KSORT_RING_H
+
+/*
+ * Kernel side of the mmap'd sample ring of ksort.h, see ring.c.  Only the
+ * benchmark thread pushes and only userspace consumes.
+ */
+struct ksort_ring;
+struct ksort_sample;
+struct vm_area_struct;
+
+extern struct ksort_ring *ksort_ring_create(void);
+extern void ksort_ring_destroy(struct ksort_ring *ring);
+
+extern void ksort_ring_reset(struct ksort_ring *ring);
+extern bool ksort_ring_push(struct ksort_ring *ring,
+                            const struct ksort_sample *sample);
+extern void ksort_ring_finish(struct ksort_ring *ring);
+
+extern int ksort_ring_mmap(struct ksort_ring *ring,
+                           struct vm_area_struct *vma);
+
+#endif
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_BUG_H
+#define KSORT_SHIM_BUG_H
+
+#include <linux/kernel.h>
+
+/* Unlike the kernel's, warns every time the condition holds */
+#define WARN_ON_ONCE(cond)                                            \
+    ({                                                                \
+        const bool __warn = !!(cond);                                 \
+        if (unlikely(__warn))                                         \
+            printk("WARNING: %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        __warn;                                                       \
+    })
+
+#endif
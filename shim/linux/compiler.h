@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_COMPILER_H
+#define KSORT_SHIM_COMPILER_H
+
+#include <linux/types.h>
+
+/* The tuning thresholds are plain integers; relaxed atomics give the same
+ * single untorn access as the kernel's volatile one */
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+
+#endif
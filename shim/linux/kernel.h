@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_KERNEL_H
+#define KSORT_SHIM_KERNEL_H
+
+#include <stdio.h>
+
+#include <linux/compiler.h>
+#include <linux/types.h>
+
+/* Log levels are dropped and everything goes to stderr */
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_ALERT ""
+
+#ifndef pr_fmt
+#define pr_fmt(fmt) fmt
+#endif
+
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...) printk(pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_warn(fmt, ...) printk(pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info(fmt, ...) printk(pr_fmt(fmt), ##__VA_ARGS__)
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#endif
@@ -0,0 +1,12 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_LIMITS_H
+#define KSORT_SHIM_LIMITS_H
+
+#include_next <linux/limits.h>
+
+#include <stdint.h>
+
+#define U32_MAX UINT32_MAX
+#define U64_MAX UINT64_MAX
+
+#endif
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_PERCPU_H
+#define KSORT_SHIM_PERCPU_H
+
+/* One thread is one CPU; only profiling builds use these */
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+#define DEFINE_PER_CPU(type, name) __typeof__(type) name
+#define this_cpu_add(var, val) ((var) += (val))
+#define this_cpu_write(var, val) ((var) = (val))
+#define this_cpu_xchg(var, val)              \
+    ({                                       \
+        __typeof__(var) __shim_old = (var);  \
+        (var) = (val);                       \
+        __shim_old;                          \
+    })
+
+#endif
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_SLAB_H
+#define KSORT_SHIM_SLAB_H
+
+#include <stdlib.h>
+#include <string.h> /* the kernel's reaches memcpy() through its includes */
+
+#include <linux/types.h>
+
+/* Allocations never sleep or fail differently here, so the flags are
+ * ignored */
+#define GFP_KERNEL 0
+
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kcalloc(n, size, flags) calloc(n, size)
+#define krealloc(p, size, flags) realloc(p, size)
+#define kfree(p) free(p)
+
+static inline void *kmalloc_array(size_t n, size_t size, int flags)
+{
+    if (size && n > SIZE_MAX / size)
+        return NULL;
+    return malloc(n * size);
+}
+
+#endif
@@ -0,0 +1,7 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef KSORT_SHIM_STRING_H
+#define KSORT_SHIM_STRING_H
+
+#include <string.h>
+
+#endif
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Userspace stand-ins for the kernel headers the engines include, so that
+ * heap.c, intro.c, pdqsort.c, indirect.c, sort.h and xoroshiro128plus.c
+ * build unchanged into ordinary programs, see "make ksort_user".  Only what
+ * the engines use is provided.  The uapi types (__u32 and friends) still come
+ * from the installed <linux/types.h>.
+ */
+#ifndef KSORT_SHIM_TYPES_H
+#define KSORT_SHIM_TYPES_H
+
+#include_next <linux/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+/* glibc's <sys/cdefs.h> has the same one */
+#ifndef __always_inline
+#define __always_inline inline __attribute__((__always_inline__))
+#endif
+
+#endif
@@ -36,6 +36,77 @@
     }
 #endif
 
+/* Cooperative rescheduling hook, e.g. cond_resched().  The long-running sorts
+ * call it between partitions, merges and heap passes, never inside them,
+ * about once per SORT_CHECKPOINT_MIN elements of work.  SORT_CHECKPOINT_MIN
+ * must be a power of two. */
+#ifndef SORT_CHECKPOINT
+#define SORT_CHECKPOINT() \
+    do {                  \
+    } while (0)
+#endif
+
+#ifndef SORT_CHECKPOINT_MIN
+#define SORT_CHECKPOINT_MIN 4096
+#endif
+
+/* Checkpoint if the indices lo and hi lie on either side of a multiple of
+ * SORT_CHECKPOINT_MIN, which every range of that many elements does. */
+#define SORT_CHECKPOINT_RANGE(lo, hi)             \
+    do {                                          \
+        if (((lo) ^ (hi)) >= SORT_CHECKPOINT_MIN) \
+            SORT_CHECKPOINT();                    \
+    } while (0)
+
+/* Tracing hooks, e.g. tracepoints.  SORT_TRACE_TIM_PUSH(start, len) runs
+ * when tim sort or power sort pushes the run [start, start + len),
+ * SORT_TRACE_TIM_MERGE(start, a, b) before they merge the runs of a and b
+ * elements at start, and SORT_TRACE_NEW_BUFFER(num, buf) after
+ * SORT_NEW_BUFFER allocated buf for num elements, NULL on failure. */
+#ifndef SORT_TRACE_TIM_PUSH
+#define SORT_TRACE_TIM_PUSH(start, len) \
+    do {                                \
+    } while (0)
+#endif
+
+#ifndef SORT_TRACE_TIM_MERGE
+#define SORT_TRACE_TIM_MERGE(start, a, b) \
+    do {                                  \
+    } while (0)
+#endif
+
+#ifndef SORT_TRACE_NEW_BUFFER
+#define SORT_TRACE_NEW_BUFFER(num, buf) \
+    do {                                \
+    } while (0)
+#endif
+
+/* Profiling hooks, e.g. cycle stamps.  SORT_PROFILE_BEGIN(phase) and
+ * SORT_PROFILE_END(phase) mark the start and end of a step of phase, one of
+ * PIVOT, PARTITION, SMALL, MERGE, HEAP and ALLOC.  The merge, bottom-up
+ * merge, quick, tim and power sorts mark their steps with them; steps of one
+ * phase never nest. */
+#ifndef SORT_PROFILE_BEGIN
+#define SORT_PROFILE_BEGIN(phase) \
+    do {                          \
+    } while (0)
+#endif
+
+#ifndef SORT_PROFILE_END
+#define SORT_PROFILE_END(phase) \
+    do {                        \
+    } while (0)
+#endif
+
+#if defined(SORT_PAYLOAD_TYPE) && !defined(SORT_PAYLOAD_SWAP)
+#define SORT_PAYLOAD_SWAP(x, y)                          \
+    {                                                    \
+        SORT_PAYLOAD_TYPE _sort_payload_swap_temp = (x); \
+        (x) = (y);                                       \
+        (y) = _sort_payload_swap_temp;                   \
+    }
+#endif
+
 /* Common, type-agnostic functions and constants that we don't want to declare
  * twice. */
 #ifndef SORT_COMMON_H
@@ -49,7 +120,7 @@
 #define MIN(x, y) (((x) < (y) ? (x) : (y)))
 #endif
 
-static int compute_minrun(const uint64_t);
+static int compute_minrun(const uint64_t, const int);
 
 /* From http://oeis.org/classic/A102549 */
 static const uint64_t shell_gaps[48] = {1,
@@ -101,6 +172,73 @@ static const uint64_t shell_gaps[48] = {1,
                                         2316921469048944978LL,
                                         5792303672622362446LL};
 
+/* Leonardo numbers L(k) = L(k - 1) + L(k - 2) + 1, the sizes of the heaps of
+ * smooth sort */
+static const uint64_t leonardo_numbers[64] = {1,
+                                              1,
+                                              3,
+                                              5,
+                                              9,
+                                              15,
+                                              25,
+                                              41,
+                                              67,
+                                              109,
+                                              177,
+                                              287,
+                                              465,
+                                              753,
+                                              1219,
+                                              1973,
+                                              3193,
+                                              5167,
+                                              8361,
+                                              13529,
+                                              21891,
+                                              35421,
+                                              57313,
+                                              92735,
+                                              150049,
+                                              242785,
+                                              392835,
+                                              635621,
+                                              1028457,
+                                              1664079,
+                                              2692537,
+                                              4356617,
+                                              7049155,
+                                              11405773,
+                                              18454929,
+                                              29860703,
+                                              48315633,
+                                              78176337,
+                                              126491971,
+                                              204668309,
+                                              331160281,
+                                              535828591,
+                                              866988873,
+                                              1402817465,
+                                              2269806339LL,
+                                              3672623805LL,
+                                              5942430145LL,
+                                              9615053951LL,
+                                              15557484097LL,
+                                              25172538049LL,
+                                              40730022147LL,
+                                              65902560197LL,
+                                              106632582345LL,
+                                              172535142543LL,
+                                              279167724889LL,
+                                              451702867433LL,
+                                              730870592323LL,
+                                              1182573459757LL,
+                                              1913444052081LL,
+                                              3096017511839LL,
+                                              5009461563921LL,
+                                              8105479075761LL,
+                                              13114940639683LL,
+                                              21220419715445LL};
+
 #ifndef CLZ
 /* clang-only */
 #ifndef __has_builtin
@@ -161,10 +299,14 @@ static int clzll(uint64_t x)
 #endif
 #endif
 
-static __inline int compute_minrun(const uint64_t size)
+/* Minimum run length of tim sort for size elements: the leading bits of size,
+ * as many as bits says, plus one if any of the others is set.  That is
+ * between 2^(bits - 1) and 2^bits once size reaches 2^bits, with size / minrun
+ * a power of two or just below one. */
+static __inline int compute_minrun(const uint64_t size, const int bits)
 {
     const int top_bit = 64 - CLZ(size);
-    const int shift = MAX(top_bit, 6) - 6;
+    const int shift = MAX(top_bit, bits) - bits;
     const int minrun = (int) (size >> shift);
     const uint64_t mask = (1ULL << shift) - 1;
 
@@ -175,6 +317,37 @@ static __inline int compute_minrun(const uint64_t size)
     return minrun;
 }
 
+/* Powersort node power of the boundary between the adjacent runs
+ * [s1, s1 + n1) and [s1 + n1, s1 + n1 + n2) of an array of n elements, i.e.
+ * the depth at which the midpoints of both runs get separated in a perfectly
+ * balanced binary merge tree over [0, n).  The quotients are compared bit by
+ * bit in units of 1 / (2 * n), so no division is needed. */
+static __inline int powersort_node_power(const size_t s1,
+                                         const size_t n1,
+                                         const size_t n2,
+                                         const size_t n)
+{
+    size_t a = 2 * s1 + n1; /* 2 * midpoint of the left run */
+    size_t b = a + n1 + n2; /* 2 * midpoint of the right run */
+    int power = 0;
+
+    while (1) {
+        ++power;
+
+        if (a >= n) { /* both quotient bits are 1 */
+            a -= n;
+            b -= n;
+        } else if (b >= n) { /* bits differ: boundary found */
+            break;
+        }
+
+        a <<= 1;
+        b <<= 1;
+    }
+
+    return power;
+}
+
 static __inline size_t rbnd(size_t len)
 {
     int k;
@@ -196,6 +369,11 @@ static __inline size_t rbnd(size_t len)
 #ifndef SMALL_SORT_BND
 #define SMALL_SORT_BND 16
 #endif
+/* Bits of the array size that make up the minimum run length of tim sort and
+ * power sort, see compute_minrun; 6 gives runs of 32 to 64 elements */
+#ifndef SORT_MINRUN_BITS
+#define SORT_MINRUN_BITS 6
+#endif
 #ifndef SMALL_SORT
 #define SMALL_SORT BITONIC_SORT
 /*#define SMALL_SORT BINARY_INSERTION_SORT*/
@@ -216,11 +394,16 @@ static __inline size_t rbnd(size_t len)
 #define TIM_SORT_RESIZE SORT_MAKE_STR(tim_sort_resize)
 #define TIM_SORT_MERGE SORT_MAKE_STR(tim_sort_merge)
 #define TIM_SORT_COLLAPSE SORT_MAKE_STR(tim_sort_collapse)
+#define POWER_SORT SORT_MAKE_STR(power_sort)
 #define HEAP_SORT SORT_MAKE_STR(heap_sort)
 #define MEDIAN SORT_MAKE_STR(median)
 #define QUICK_SORT SORT_MAKE_STR(quick_sort)
 #define MERGE_SORT SORT_MAKE_STR(merge_sort)
 #define MERGE_SORT_RECURSIVE SORT_MAKE_STR(merge_sort_recursive)
+#define MERGE_SORT_BOTTOM_UP SORT_MAKE_STR(merge_sort_bottom_up)
+#define MERGE_TWO SORT_MAKE_STR(merge_two)
+#define MERGE_K SORT_MAKE_STR(merge_k)
+#define MERGE_K_BEATS SORT_MAKE_STR(merge_k_beats)
 #define MERGE_SORT_IN_PLACE SORT_MAKE_STR(merge_sort_in_place)
 #define MERGE_SORT_IN_PLACE_RMERGE SORT_MAKE_STR(merge_sort_in_place_rmerge)
 #define MERGE_SORT_IN_PLACE_BACKMERGE \
@@ -234,6 +417,11 @@ static __inline size_t rbnd(size_t len)
 #define QUICK_SORT_RECURSIVE SORT_MAKE_STR(quick_sort_recursive)
 #define HEAP_SIFT_DOWN SORT_MAKE_STR(heap_sift_down)
 #define HEAPIFY SORT_MAKE_STR(heapify)
+#define WEAK_HEAP_JOIN SORT_MAKE_STR(weak_heap_join)
+#define WEAK_HEAP_SORT SORT_MAKE_STR(weak_heap_sort)
+#define SMOOTH_SORT_SIFT SORT_MAKE_STR(smooth_sort_sift)
+#define SMOOTH_SORT_TRINKLE SORT_MAKE_STR(smooth_sort_trinkle)
+#define SMOOTH_SORT SORT_MAKE_STR(smooth_sort)
 #define TIM_SORT_RUN_T SORT_MAKE_STR(tim_sort_run_t)
 #define TEMP_STORAGE_T SORT_MAKE_STR(temp_storage_t)
 #define PUSH_NEXT SORT_MAKE_STR(push_next)
@@ -280,6 +468,17 @@ static __inline size_t rbnd(size_t len)
 #define SQRT_SORT_COMBINE_BLOCKS SORT_MAKE_STR(sqrt_sort_combine_blocks)
 #define SQRT_SORT_COMMON_SORT SORT_MAKE_STR(sqrt_sort_common_sort)
 #define BUBBLE_SORT SORT_MAKE_STR(bubble_sort)
+#define RADIX_SORT SORT_MAKE_STR(radix_sort)
+#define AUTO_SORT SORT_MAKE_STR(auto)
+#define KV_INSERTION_SORT SORT_MAKE_STR(kv_insertion_sort)
+#define KV_HEAP_SIFT_DOWN SORT_MAKE_STR(kv_heap_sift_down)
+#define KV_HEAP_SORT SORT_MAKE_STR(kv_heap_sort)
+#define KV_MEDIAN SORT_MAKE_STR(kv_median)
+#define KV_QUICK_SORT_RECURSIVE SORT_MAKE_STR(kv_quick_sort_recursive)
+#define KV_QUICK_SORT SORT_MAKE_STR(kv_quick_sort)
+#define KV_MERGE_TWO SORT_MAKE_STR(kv_merge_two)
+#define KV_MERGE_SORT SORT_MAKE_STR(kv_merge_sort)
+#define KV_RADIX_SORT SORT_MAKE_STR(kv_radix_sort)
 
 #ifndef MAX
 #define MAX(x, y) (((x) > (y) ? (x) : (y)))
@@ -299,18 +498,38 @@ static __inline size_t rbnd(size_t len)
 typedef struct {
     size_t start;
     size_t length;
+    int power; /* powersort: power of the boundary to the next run */
 } TIM_SORT_RUN_T;
 
 
 void SHELL_SORT(SORT_TYPE *dst, const size_t size);
 void BINARY_INSERTION_SORT(SORT_TYPE *dst, const size_t size);
 void HEAP_SORT(SORT_TYPE *dst, const size_t size);
+void WEAK_HEAP_SORT(SORT_TYPE *dst, const size_t size);
+void SMOOTH_SORT(SORT_TYPE *dst, const size_t size);
 void QUICK_SORT(SORT_TYPE *dst, const size_t size);
 void MERGE_SORT(SORT_TYPE *dst, const size_t size);
+void MERGE_SORT_BOTTOM_UP(SORT_TYPE *dst, const size_t size);
+void MERGE_K(SORT_TYPE *out,
+             const SORT_TYPE *const *runs,
+             const size_t *lens,
+             const size_t k);
 void MERGE_SORT_IN_PLACE(SORT_TYPE *dst, const size_t size);
 void SELECTION_SORT(SORT_TYPE *dst, const size_t size);
 void TIM_SORT(SORT_TYPE *dst, const size_t size);
+void POWER_SORT(SORT_TYPE *dst, const size_t size);
 void BUBBLE_SORT(SORT_TYPE *dst, const size_t size);
+#ifdef SORT_RADIX_KEY
+void RADIX_SORT(SORT_TYPE *dst, const size_t size);
+#endif
+void AUTO_SORT(SORT_TYPE *dst, const size_t size);
+#ifdef SORT_PAYLOAD_TYPE
+void KV_QUICK_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size);
+void KV_MERGE_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size);
+#ifdef SORT_RADIX_KEY
+void KV_RADIX_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size);
+#endif
+#endif
 void BITONIC_SORT(SORT_TYPE *dst, const size_t size);
 void REC_STABLE_SORT(SORT_TYPE *dst, const size_t size);
 void GRAIL_SORT_DYN_BUFFER(SORT_TYPE *dst, const size_t size);
@@ -318,6 +537,36 @@ void GRAIL_SORT_FIXED_BUFFER(SORT_TYPE *dst, const size_t size);
 void GRAIL_SORT(SORT_TYPE *dst, const size_t size);
 void SQRT_SORT(SORT_TYPE *dst, const size_t size);
 
+/* Whether each sort allocates a buffer or stack with SORT_NEW_BUFFER() or
+ * kmalloc(), and so may sleep: only the others can run in atomic context. */
+enum {
+    SORT_MAKE_STR(shell_sort_allocates) = 0,
+    SORT_MAKE_STR(binary_insertion_sort_allocates) = 0,
+    SORT_MAKE_STR(heap_sort_allocates) = 0,
+    SORT_MAKE_STR(weak_heap_sort_allocates) = 1,
+    SORT_MAKE_STR(smooth_sort_allocates) = 0,
+    SORT_MAKE_STR(quick_sort_allocates) = 0,
+    SORT_MAKE_STR(merge_sort_allocates) = 1,
+    SORT_MAKE_STR(merge_sort_bottom_up_allocates) = 1,
+    SORT_MAKE_STR(merge_k_allocates) = 1,
+    SORT_MAKE_STR(merge_sort_in_place_allocates) = 0,
+    SORT_MAKE_STR(selection_sort_allocates) = 0,
+    SORT_MAKE_STR(tim_sort_allocates) = 1,
+    SORT_MAKE_STR(power_sort_allocates) = 1,
+    SORT_MAKE_STR(bubble_sort_allocates) = 0,
+    SORT_MAKE_STR(radix_sort_allocates) = 1,
+    SORT_MAKE_STR(auto_allocates) = 1,
+    SORT_MAKE_STR(kv_quick_sort_allocates) = 0,
+    SORT_MAKE_STR(kv_merge_sort_allocates) = 1,
+    SORT_MAKE_STR(kv_radix_sort_allocates) = 1,
+    SORT_MAKE_STR(bitonic_sort_allocates) = 0,
+    SORT_MAKE_STR(rec_stable_sort_allocates) = 0,
+    SORT_MAKE_STR(grail_sort_dyn_buffer_allocates) = 1,
+    SORT_MAKE_STR(grail_sort_fixed_buffer_allocates) = 1,
+    SORT_MAKE_STR(grail_sort_allocates) = 0,
+    SORT_MAKE_STR(sqrt_sort_allocates) = 1,
+};
+
 /* The full implementation of a bitonic sort is not here. Since we only want to
    use sorting networks for small length lists we create optimal sorting
    networks for lists of length <= 16 and call out to BINARY_INSERTION_SORT for
@@ -928,11 +1177,17 @@ void SORT_TYPE_MOVE(SORT_TYPE *dst, SORT_TYPE *src, const size_t size)
 
 SORT_TYPE *SORT_NEW_BUFFER(size_t size)
 {
+    SORT_TYPE *buf;
+
+    SORT_PROFILE_BEGIN(ALLOC);
 #if SORT_SAFE_CPY
-    return new SORT_TYPE[size];
+    buf = new SORT_TYPE[size];
 #else
-    return (SORT_TYPE *) kmalloc(size * sizeof(SORT_TYPE), GFP_KERNEL);
+    buf = (SORT_TYPE *) kmalloc(size * sizeof(SORT_TYPE), GFP_KERNEL);
 #endif
+    SORT_PROFILE_END(ALLOC);
+    SORT_TRACE_NEW_BUFFER(size, buf);
+    return buf;
 }
 
 void SORT_DELETE_BUFFER(SORT_TYPE *pointer)
@@ -965,6 +1220,10 @@ void SHELL_SORT(SORT_TYPE *dst, const size_t size)
     }
 
     while (1) {
+        if (size >= SORT_CHECKPOINT_MIN) {
+            SORT_CHECKPOINT();
+        }
+
         for (i = inc; i < size; i++) {
             SORT_TYPE temp = dst[i];
             size_t j = i;
@@ -1327,13 +1586,185 @@ void MERGE_SORT_IN_PLACE(SORT_TYPE *dst, const size_t len)
     MERGE_SORT_IN_PLACE(dst, m);
 }
 
+/* In-register bitonic merge used by MERGE_TWO.  Define SORT_SIMD_MERGE to 32
+ * or 64 when SORT_TYPE is a plain unsigned integer of that width ordered by
+ * the default SORT_CMP; equal keys are then indistinguishable, so the
+ * unstable network still yields a stable merge.  It needs vector unsigned
+ * min/max (SSE4.1 for 32-bit, AVX2 for 64-bit keys).  kbuild compiles the
+ * module without SIMD, so main.c leaves it undefined; "make check_user" runs
+ * both widths in ksort_user. */
+#if defined(SORT_SIMD_MERGE) &&                             \
+    ((SORT_SIMD_MERGE == 64 && defined(__AVX2__)) ||        \
+     (SORT_SIMD_MERGE == 32 && defined(__SSE4_1__)))
+#define SORT_VEC_T SORT_MAKE_STR(vec_t)
+#define SORT_VEC_MASK_T SORT_MAKE_STR(vec_mask_t)
+#define SORT_VEC_MINMAX SORT_MAKE_STR(vec_minmax)
+#define BITONIC_MERGE_VEC SORT_MAKE_STR(bitonic_merge_vec)
+#define SORT_VEC_LANES 4
+
+#if SORT_SIMD_MERGE == 64
+typedef uint64_t SORT_VEC_T __attribute__((vector_size(32)));
+typedef int64_t SORT_VEC_MASK_T __attribute__((vector_size(32)));
+#else
+typedef uint32_t SORT_VEC_T __attribute__((vector_size(16)));
+typedef int32_t SORT_VEC_MASK_T __attribute__((vector_size(16)));
+#endif
+
+#ifdef __clang__
+#define SORT_VEC_SHUF2(a, b, i, j, k, l) \
+    __builtin_shufflevector(a, b, i, j, k, l)
+#else
+#define SORT_VEC_SHUF2(a, b, i, j, k, l) \
+    __builtin_shuffle(a, b, (SORT_VEC_MASK_T){i, j, k, l})
+#endif
+
+static __inline void SORT_VEC_MINMAX(SORT_VEC_T *lo, SORT_VEC_T *hi)
+{
+    const SORT_VEC_T a = *lo, b = *hi;
+    const SORT_VEC_T m = (SORT_VEC_T) (a < b);
+
+    *lo = (a & m) | (b & ~m);
+    *hi = (b & m) | (a & ~m);
+}
+
+/* Merge the sorted vectors *a and *b: on return *a holds the four smallest
+ * and *b the four largest elements, both sorted. */
+static __inline void BITONIC_MERGE_VEC(SORT_VEC_T *a, SORT_VEC_T *b)
+{
+    SORT_VEC_T l, h;
+
+    /* reversing b makes a ++ b bitonic */
+    *b = SORT_VEC_SHUF2(*b, *b, 3, 2, 1, 0);
+    SORT_VEC_MINMAX(a, b);
+
+    /* half-cleaners of distance 2, both halves at once */
+    l = SORT_VEC_SHUF2(*a, *b, 0, 1, 4, 5);
+    h = SORT_VEC_SHUF2(*a, *b, 2, 3, 6, 7);
+    SORT_VEC_MINMAX(&l, &h);
+
+    /* half-cleaners of distance 1 */
+    *a = SORT_VEC_SHUF2(l, h, 0, 4, 2, 6);
+    *b = SORT_VEC_SHUF2(l, h, 1, 5, 3, 7);
+    SORT_VEC_MINMAX(a, b);
+
+    l = SORT_VEC_SHUF2(*a, *b, 0, 4, 1, 5);
+    h = SORT_VEC_SHUF2(*a, *b, 2, 6, 3, 7);
+    *a = l;
+    *b = h;
+}
+#endif
+
+/* Stable merge of a[0..na) and b[0..nb) into out[0..na+nb).  The comparison
+ * result selects the source element instead of a branch, and the loop is
+ * unrolled by two while both inputs still hold at least two elements.
+ *
+ * out may alias the inputs as long as it never overtakes unread input: it may
+ * start at b when a is a separate buffer (tim sort left merge), or nb or more
+ * elements before a when b follows a (grail/sqrt merges into the buffer). */
+static __inline void MERGE_TWO(SORT_TYPE *out,
+                               const SORT_TYPE *a,
+                               const size_t na,
+                               const SORT_TYPE *b,
+                               const size_t nb)
+{
+    const SORT_TYPE *const a_end = a + na;
+    const SORT_TYPE *const b_end = b + nb;
+    int take_b;
+
+#ifdef SORT_VEC_T
+    if (na >= SORT_VEC_LANES && nb >= SORT_VEC_LANES) {
+        SORT_VEC_T lo, hi;
+        SORT_TYPE pending[SORT_VEC_LANES];
+        size_t h = 0;
+
+        memcpy(&lo, a, sizeof(lo));
+        memcpy(&hi, b, sizeof(hi));
+        a += SORT_VEC_LANES;
+        b += SORT_VEC_LANES;
+
+        while (1) {
+            const SORT_TYPE **next;
+
+            BITONIC_MERGE_VEC(&lo, &hi);
+            memcpy(out, &lo, sizeof(lo));
+            out += SORT_VEC_LANES;
+
+            /* Refill from the input with the smaller head; stop once that
+             * input can't supply a whole vector. */
+            if (a < a_end && (b == b_end || SORT_CMP(*b, *a) >= 0)) {
+                next = &a;
+                take_b = (size_t) (a_end - a) < SORT_VEC_LANES;
+            } else {
+                next = &b;
+                take_b = (size_t) (b_end - b) < SORT_VEC_LANES;
+            }
+
+            if (take_b) {
+                break;
+            }
+
+            memcpy(&lo, *next, sizeof(lo));
+            *next += SORT_VEC_LANES;
+        }
+
+        /* hi is sorted and not smaller than anything written so far: merge
+         * it with both remaining tails. */
+        memcpy(pending, &hi, sizeof(hi));
+
+        while (h < SORT_VEC_LANES) {
+            const SORT_TYPE *m = &pending[h];
+
+            if (a < a_end && SORT_CMP(*a, *m) < 0) {
+                m = a;
+            }
+
+            if (b < b_end && SORT_CMP(*b, *m) < 0) {
+                m = b;
+            }
+
+            *out++ = *m;
+
+            if (m == a) {
+                a++;
+            } else if (m == b) {
+                b++;
+            } else {
+                h++;
+            }
+        }
+    }
+#endif
+
+    while (a + 1 < a_end && b + 1 < b_end) {
+        take_b = SORT_CMP(*b, *a) < 0;
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+
+        take_b = SORT_CMP(*b, *a) < 0;
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+
+    while (a < a_end && b < b_end) {
+        take_b = SORT_CMP(*b, *a) < 0;
+        *out++ = take_b ? *b : *a;
+        b += take_b;
+        a += !take_b;
+    }
+
+    if (a < a_end) {
+        SORT_TYPE_MOVE(out, (SORT_TYPE *) a, (size_t) (a_end - a));
+    } else if (b < b_end && out != b) {
+        SORT_TYPE_MOVE(out, (SORT_TYPE *) b, (size_t) (b_end - b));
+    }
+}
+
 /* Standard merge sort */
 void MERGE_SORT_RECURSIVE(SORT_TYPE *newdst, SORT_TYPE *dst, const size_t size)
 {
     const size_t middle = size / 2;
-    size_t out = 0;
-    size_t i = 0;
-    size_t j = middle;
 
     /* don't bother sorting an array of size <= 1 */
     if (size <= 1) {
@@ -1341,32 +1772,22 @@ void MERGE_SORT_RECURSIVE(SORT_TYPE *newdst, SORT_TYPE *dst, const size_t size)
     }
 
     if (size <= SMALL_SORT_BND) {
+        SORT_PROFILE_BEGIN(SMALL);
         BINARY_INSERTION_SORT(dst, size);
+        SORT_PROFILE_END(SMALL);
         return;
     }
 
     MERGE_SORT_RECURSIVE(newdst, dst, middle);
     MERGE_SORT_RECURSIVE(newdst, &dst[middle], size - middle);
-
-    while (out != size) {
-        if (i < middle) {
-            if (j < size) {
-                if (SORT_CMP(dst[i], dst[j]) <= 0) {
-                    newdst[out] = dst[i++];
-                } else {
-                    newdst[out] = dst[j++];
-                }
-            } else {
-                newdst[out] = dst[i++];
-            }
-        } else {
-            newdst[out] = dst[j++];
-        }
-
-        out++;
+    if (size >= SORT_CHECKPOINT_MIN) {
+        SORT_CHECKPOINT();
     }
 
+    SORT_PROFILE_BEGIN(MERGE);
+    MERGE_TWO(newdst, dst, middle, &dst[middle], size - middle);
     SORT_TYPE_CPY(dst, newdst, size);
+    SORT_PROFILE_END(MERGE);
 }
 
 /* Standard merge sort */
@@ -1380,7 +1801,9 @@ void MERGE_SORT(SORT_TYPE *dst, const size_t size)
     }
 
     if (size <= SMALL_SORT_BND) {
+        SORT_PROFILE_BEGIN(SMALL);
         BINARY_INSERTION_SORT(dst, size);
+        SORT_PROFILE_END(SMALL);
         return;
     }
 
@@ -1389,6 +1812,235 @@ void MERGE_SORT(SORT_TYPE *dst, const size_t size)
     SORT_DELETE_BUFFER(newdst);
 }
 
+/* Bottom-up merge sort.  Runs of at most SMALL_SORT_BND elements are sorted
+ * in place, then every pass merges pairs of runs from one buffer into the
+ * other, so each element is moved once per pass instead of being merged and
+ * copied back at every level as in MERGE_SORT_RECURSIVE.  The leaf run length
+ * is picked so that the number of passes is even whenever possible, which
+ * leaves the result in dst without the final copy. */
+void MERGE_SORT_BOTTOM_UP(SORT_TYPE *dst, const size_t size)
+{
+    SORT_TYPE *buf, *src, *out, *tmp;
+    size_t run = SMALL_SORT_BND;
+    size_t width, lo;
+    int passes = 0;
+
+    /* don't bother sorting an array of size <= 1 */
+    if (size <= 1) {
+        return;
+    }
+
+    if (size <= SMALL_SORT_BND) {
+        SORT_PROFILE_BEGIN(SMALL);
+        BINARY_INSERTION_SORT(dst, size);
+        SORT_PROFILE_END(SMALL);
+        return;
+    }
+
+    buf = SORT_NEW_BUFFER(size);
+
+    if (buf == NULL) {
+        MERGE_SORT_IN_PLACE(dst, size);
+        return;
+    }
+
+    for (width = run; width < size; width *= 2) {
+        passes++;
+    }
+
+    if ((passes & 1) && run > 1) {
+        run = (run + 1) / 2;
+    }
+
+    SORT_PROFILE_BEGIN(SMALL);
+    for (lo = 0; lo < size; lo += run) {
+        BINARY_INSERTION_SORT(&dst[lo], MIN(run, size - lo));
+    }
+    SORT_PROFILE_END(SMALL);
+
+    src = dst;
+    out = buf;
+
+    for (width = run; width < size; width *= 2) {
+        SORT_PROFILE_BEGIN(MERGE);
+        for (lo = 0; lo < size; lo += 2 * width) {
+            const size_t mid = MIN(lo + width, size);
+            const size_t hi = MIN(lo + 2 * width, size);
+            SORT_CHECKPOINT_RANGE(lo, hi);
+            MERGE_TWO(&out[lo], &src[lo], mid - lo, &src[mid], hi - mid);
+        }
+        SORT_PROFILE_END(MERGE);
+
+        tmp = src;
+        src = out;
+        out = tmp;
+    }
+
+    if (src != dst) {
+        SORT_PROFILE_BEGIN(MERGE);
+        SORT_TYPE_CPY(dst, src, size);
+        SORT_PROFILE_END(MERGE);
+    }
+
+    SORT_DELETE_BUFFER(buf);
+}
+
+/* Does run i win against run j in MERGE_K?  head[] caches the current
+ * element of every run and live[] says whether there is one; an exhausted
+ * run loses to everything, and equal heads go to the lower run index to keep
+ * the merge stable.  The heads of runs that are not live are still compared,
+ * so MERGE_K keeps every slot of head[] initialized.  Both "less" and "not
+ * greater" are tested, rather than comparing one SORT_CMP result with the
+ * tie break, so that the default SORT_CMP folds into flag selects instead of
+ * a data-dependent branch. */
+static __inline int MERGE_K_BEATS(const SORT_TYPE *head,
+                                  const unsigned char *live,
+                                  const size_t i,
+                                  const size_t j)
+{
+    const int lt = SORT_CMP(head[i], head[j]) < 0;
+    const int le = SORT_CMP(head[j], head[i]) >= 0;
+    const int first = i < j;
+    const int wins = (first & le) | ((first ^ 1) & lt);
+
+    return (live[j] ^ 1) | (live[i] & wins);
+}
+
+/* Stable merge of the k sorted runs runs[0..k), of lens[0..k) elements each,
+ * into out, which must not overlap them.  Runs can be shards sorted
+ * separately, e.g. by the workers of a parallel sort, or the pending runs of
+ * a tim sort.
+ *
+ * Two runs go straight to MERGE_TWO.  More are merged with a loser tree:
+ * tree[1..k) holds the run that lost the match at each inner node, tree[0]
+ * the overall winner, and leaf j sits at node k + j.  Taking the winner's
+ * next element only replays the matches on the path from its leaf to the
+ * root, so each output element costs about log2(k) compares against a tree
+ * and k cached heads that stay in cache.  The match outcomes are data
+ * dependent, so the replay masks instead of branching on them.  If the tree
+ * can't be allocated, the runs are concatenated and sorted with the in-place
+ * GRAIL_SORT instead. */
+void MERGE_K(SORT_TYPE *out,
+             const SORT_TYPE *const *runs,
+             const size_t *lens,
+             const size_t k)
+{
+    const SORT_TYPE **pos, **end;
+    SORT_TYPE *head;
+    unsigned char *live;
+    size_t *tree;
+    size_t total = 0, i, node, w, t, m;
+
+    if (k == 0) {
+        return;
+    }
+
+    if (k == 1) {
+        SORT_TYPE_CPY(out, (SORT_TYPE *) runs[0], lens[0]);
+        return;
+    }
+
+    if (k == 2) {
+        MERGE_TWO(out, runs[0], lens[0], runs[1], lens[1]);
+        return;
+    }
+
+    head = SORT_NEW_BUFFER(k);
+    tree = kmalloc(k * (sizeof(*tree) + 2 * sizeof(*pos) + sizeof(*live)),
+                   GFP_KERNEL);
+
+    if (head == NULL || tree == NULL) {
+        SORT_DELETE_BUFFER(head);
+        kfree(tree);
+
+        for (i = 0; i < k; i++) {
+            SORT_TYPE_CPY(&out[total], (SORT_TYPE *) runs[i], lens[i]);
+            total += lens[i];
+        }
+
+        GRAIL_SORT(out, total);
+        return;
+    }
+
+    pos = (const SORT_TYPE **) (tree + k);
+    end = pos + k;
+    live = (unsigned char *) (end + k);
+    w = 0;
+
+    for (i = 0; i < k; i++) {
+        pos[i] = runs[i];
+        end[i] = runs[i] + lens[i];
+        live[i] = lens[i] != 0;
+        total += lens[i];
+        tree[i] = k; /* no run parked yet */
+
+        if (live[i]) {
+            head[i] = *pos[i];
+            w = i;
+        }
+    }
+
+    if (total == 0) {
+        SORT_DELETE_BUFFER(head);
+        kfree(tree);
+        return;
+    }
+
+    /* Empty runs never load a head of their own; w is a live run */
+    for (i = 0; i < k; i++) {
+        if (!live[i]) {
+            head[i] = head[w];
+        }
+    }
+
+    /* Build the tree by sending every leaf up until it finds an empty node
+     * to wait at; the second run to reach a node plays the first there, and
+     * the winner goes on. */
+    for (i = 0; i < k; i++) {
+        w = i;
+
+        for (node = (k + i) / 2; node > 0; node /= 2) {
+            t = tree[node];
+
+            if (t == k) {
+                tree[node] = w;
+                break;
+            }
+
+            if (MERGE_K_BEATS(head, live, t, w)) {
+                tree[node] = w;
+                w = t;
+            }
+        }
+
+        if (node == 0) {
+            tree[0] = w;
+        }
+    }
+
+    while (total--) {
+        w = tree[0];
+        *out++ = head[w];
+
+        if (++pos[w] < end[w]) {
+            head[w] = *pos[w];
+        } else {
+            live[w] = 0;
+        }
+
+        for (node = (k + w) / 2; node > 0; node /= 2) {
+            t = tree[node];
+            m = (t ^ w) & -(size_t) MERGE_K_BEATS(head, live, t, w);
+            tree[node] = t ^ m;
+            w ^= m;
+        }
+
+        tree[0] = w;
+    }
+
+    kfree(tree);
+    SORT_DELETE_BUFFER(head);
+}
 
 static __inline size_t QUICK_SORT_PARTITION(SORT_TYPE *dst,
                                             const size_t left,
@@ -1507,7 +2159,8 @@ static void QUICK_SORT_RECURSIVE(SORT_TYPE *dst,
     size_t left;
     size_t right;
     int loop_count = 0;
-    const int max_loops = 64 - CLZ(original_right - original_left); /* ~lg N */
+    /* ~lg N; the | 1 keeps CLZ defined when the range has one element */
+    const int max_loops = 64 - CLZ((original_right - original_left) | 1);
     left = original_left;
     right = original_right;
 
@@ -1520,22 +2173,32 @@ static void QUICK_SORT_RECURSIVE(SORT_TYPE *dst,
         }
 
         if ((right - left + 1U) <= SMALL_SORT_BND) {
+            SORT_PROFILE_BEGIN(SMALL);
             SMALL_SORT(&dst[left], right - left + 1U);
+            SORT_PROFILE_END(SMALL);
             return;
         }
 
         if (++loop_count >= max_loops) {
             /* we have recursed / looped too many times; switch to heap sort */
+            SORT_PROFILE_BEGIN(HEAP);
             HEAP_SORT(&dst[left], right - left + 1U);
+            SORT_PROFILE_END(HEAP);
             return;
         }
 
+        SORT_CHECKPOINT_RANGE(left, right);
+
         /* median of 5 */
         middle = left + ((right - left) >> 1);
+        SORT_PROFILE_BEGIN(PIVOT);
         pivot = MEDIAN((const SORT_TYPE *) dst, left, middle, right);
         pivot = MEDIAN((const SORT_TYPE *) dst, left + ((middle - left) >> 1),
                        pivot, middle + ((right - middle) >> 1));
+        SORT_PROFILE_END(PIVOT);
+        SORT_PROFILE_BEGIN(PARTITION);
         new_pivot = QUICK_SORT_PARTITION(dst, left, right, pivot);
+        SORT_PROFILE_END(PARTITION);
 
         /* check for partition all equal */
         if (new_pivot == SIZE_MAX) {
@@ -1700,28 +2363,18 @@ static void TIM_SORT_MERGE(SORT_TYPE *dst,
     const size_t curr = stack[stack_curr - 2].start;
     SORT_TYPE *storage;
     size_t i, j, k;
+    SORT_CHECKPOINT_RANGE(curr, curr + A + B);
+    SORT_TRACE_TIM_MERGE(curr, A, B);
+    SORT_PROFILE_BEGIN(ALLOC);
     TIM_SORT_RESIZE(store, MIN(A, B));
+    SORT_PROFILE_END(ALLOC);
     storage = store->storage;
 
+    SORT_PROFILE_BEGIN(MERGE);
     /* left merge */
     if (A < B) {
         SORT_TYPE_CPY(storage, &dst[curr], A);
-        i = 0;
-        j = curr + A;
-
-        for (k = curr; k < curr + A + B; k++) {
-            if ((i < A) && (j < curr + A + B)) {
-                if (SORT_CMP(storage[i], dst[j]) <= 0) {
-                    dst[k] = storage[i++];
-                } else {
-                    dst[k] = dst[j++];
-                }
-            } else if (i < A) {
-                dst[k] = storage[i++];
-            } else {
-                break;
-            }
-        }
+        MERGE_TWO(&dst[curr], storage, A, &dst[curr + A], B);
     } else {
         /* right merge */
         SORT_TYPE_CPY(storage, &dst[curr + A], B);
@@ -1743,6 +2396,7 @@ static void TIM_SORT_MERGE(SORT_TYPE *dst,
             }
         }
     }
+    SORT_PROFILE_END(MERGE);
 }
 
 static int TIM_SORT_COLLAPSE(SORT_TYPE *dst,
@@ -1830,13 +2484,16 @@ static __inline int PUSH_NEXT(SORT_TYPE *dst,
     }
 
     if (run > len) {
+        SORT_PROFILE_BEGIN(SMALL);
         BINARY_INSERTION_SORT_START(&dst[*curr], len, run);
+        SORT_PROFILE_END(SMALL);
         len = run;
     }
 
     run_stack[*stack_curr].start = *curr;
     run_stack[*stack_curr].length = len;
     (*stack_curr)++;
+    SORT_TRACE_TIM_PUSH(*curr, len);
     *curr += len;
 
     if (*curr == size) {
@@ -1864,23 +2521,34 @@ void TIM_SORT(SORT_TYPE *dst, const size_t size)
     size_t minrun;
     TEMP_STORAGE_T _store, *store;
     // TIM_SORT_RUN_T run_stack[TIM_SORT_STACK_SIZE];
-    TIM_SORT_RUN_T *run_stack =
-        kmalloc(sizeof(TIM_SORT_RUN_T) * TIM_SORT_STACK_SIZE, GFP_KERNEL);
+    TIM_SORT_RUN_T *run_stack;
     size_t stack_curr = 0;
     size_t curr = 0;
 
+#ifdef TIM_SORT_POWERSORT
+    POWER_SORT(dst, size);
+    return;
+#endif
+
     /* don't bother sorting an array of size 1 */
     if (size <= 1) {
         return;
     }
 
     if (size < 64) {
+        SORT_PROFILE_BEGIN(SMALL);
         SMALL_SORT(dst, size);
+        SORT_PROFILE_END(SMALL);
         return;
     }
 
+    SORT_PROFILE_BEGIN(ALLOC);
+    run_stack =
+        kmalloc(sizeof(TIM_SORT_RUN_T) * TIM_SORT_STACK_SIZE, GFP_KERNEL);
+    SORT_PROFILE_END(ALLOC);
+
     /* compute the minimum run length */
-    minrun = compute_minrun(size);
+    minrun = compute_minrun(size, SORT_MINRUN_BITS);
     /* temporary storage for merges */
     store = &_store;
     store->alloc = 0;
@@ -1916,6 +2584,89 @@ void TIM_SORT(SORT_TYPE *dst, const size_t size)
     }
 }
 
+/* Powersort: timsort's run detection with the merge policy of Munro & Wild,
+ * "Nearly-Optimal Mergesorts" (ESA 2018).  Instead of the stack invariants of
+ * CHECK_INVARIANT / TIM_SORT_COLLAPSE, every boundary between two adjacent runs
+ * gets a node power (see powersort_node_power) and the stack is collapsed
+ * while the boundary below its top is deeper than the new one.  The merge cost
+ * is within O(n) of the optimum for the given runs, and since powers strictly
+ * increase up the stack it never holds more than log2(n) + 1 runs.
+ *
+ * Defining TIM_SORT_POWERSORT makes TIM_SORT use this policy. */
+void POWER_SORT(SORT_TYPE *dst, const size_t size)
+{
+    size_t minrun;
+    TEMP_STORAGE_T _store, *store;
+    TIM_SORT_RUN_T *run_stack;
+    size_t stack_curr = 0;
+    size_t curr = 0;
+
+    /* don't bother sorting an array of size 1 */
+    if (size <= 1) {
+        return;
+    }
+
+    if (size < 64) {
+        SORT_PROFILE_BEGIN(SMALL);
+        SMALL_SORT(dst, size);
+        SORT_PROFILE_END(SMALL);
+        return;
+    }
+
+    SORT_PROFILE_BEGIN(ALLOC);
+    run_stack =
+        kmalloc(sizeof(TIM_SORT_RUN_T) * TIM_SORT_STACK_SIZE, GFP_KERNEL);
+    SORT_PROFILE_END(ALLOC);
+    minrun = compute_minrun(size, SORT_MINRUN_BITS);
+    store = &_store;
+    store->alloc = 0;
+    store->storage = NULL;
+
+    while (curr < size) {
+        size_t len = COUNT_RUN(dst, curr, size);
+        const size_t run = MIN(minrun, size - curr);
+
+        if (run > len) {
+            SORT_PROFILE_BEGIN(SMALL);
+            BINARY_INSERTION_SORT_START(&dst[curr], len, run);
+            SORT_PROFILE_END(SMALL);
+            len = run;
+        }
+
+        if (stack_curr > 0) {
+            const int power =
+                powersort_node_power(run_stack[stack_curr - 1].start,
+                                     run_stack[stack_curr - 1].length, len,
+                                     size);
+
+            while (stack_curr > 1 && run_stack[stack_curr - 2].power > power) {
+                TIM_SORT_MERGE(dst, run_stack, (int) stack_curr, store);
+                run_stack[stack_curr - 2].length +=
+                    run_stack[stack_curr - 1].length;
+                stack_curr--;
+            }
+
+            run_stack[stack_curr - 1].power = power;
+        }
+
+        run_stack[stack_curr].start = curr;
+        run_stack[stack_curr].length = len;
+        stack_curr++;
+        SORT_TRACE_TIM_PUSH(curr, len);
+        curr += len;
+    }
+
+    /* finish up */
+    while (stack_curr > 1) {
+        TIM_SORT_MERGE(dst, run_stack, (int) stack_curr, store);
+        run_stack[stack_curr - 2].length += run_stack[stack_curr - 1].length;
+        stack_curr--;
+    }
+
+    kfree(store->storage);
+    kfree(run_stack);
+}
+
 /* heap sort: based on wikipedia */
 
 static __inline void HEAP_SIFT_DOWN(SORT_TYPE *dst,
@@ -1951,6 +2702,7 @@ static __inline void HEAPIFY(SORT_TYPE *dst, const size_t size)
             break;
         }
 
+        SORT_CHECKPOINT_RANGE(start - 1, start);
         start--;
     }
 }
@@ -1967,43 +2719,273 @@ void HEAP_SORT(SORT_TYPE *dst, const size_t size)
     HEAPIFY(dst, size);
 
     while (end > 0) {
+        SORT_CHECKPOINT_RANGE(end - 1, end);
         SORT_SWAP(dst[end], dst[0]);
         HEAP_SIFT_DOWN(dst, 0, end - 1);
         end--;
     }
 }
 
-/********* Sqrt sorting *********************************/
-/*                                                       */
-/* (c) 2014 by Andrey Astrelin                           */
-/*                                                       */
-/*                                                       */
-/* Stable sorting that works in O(N*log(N)) worst time   */
-/* and uses O(sqrt(N)) extra memory                      */
-/*                                                       */
-/* Define SORT_TYPE and SORT_CMP                         */
-/* and then call SqrtSort() function                     */
-/*                                                       */
-/*********************************************************/
-
-#define SORT_CMP_A(a, b) SORT_CMP(*(a), *(b))
-
-static __inline void SQRT_SORT_SWAP_1(SORT_TYPE *a, SORT_TYPE *b)
-{
-    SORT_TYPE c = *a;
-    *a++ = *b;
-    *b++ = c;
-}
-
-static __inline void SQRT_SORT_SWAP_N(SORT_TYPE *a, SORT_TYPE *b, int n)
+/* weak-heap sort: Dutton, and Edelkamp & Wegener, "On the performance of
+ * WEAK-HEAPSORT".  A weak heap only orders every element before its right
+ * subtree, and one reverse bit per element says which child is the right
+ * one.  That relaxation lets it sort with about n log n - 0.9n comparisons
+ * on average and at most n log n + 0.1n, against about 2n log n for heap
+ * sort.  The n bits are the only extra memory; if they can't be allocated,
+ * this falls back to heap sort. */
+
+#define WEAK_HEAP_BIT(r, i) (((r)[(i) >> 3] >> ((i) & 7)) & 1)
+
+/* join the weak heap rooted at j into the one rooted at its distinguished
+ * ancestor i */
+static __inline void WEAK_HEAP_JOIN(SORT_TYPE *dst,
+                                    unsigned char *r,
+                                    const size_t i,
+                                    const size_t j)
 {
-    while (n--) {
-        SQRT_SORT_SWAP_1(a++, b++);
+    if (SORT_CMP(dst[i], dst[j]) < 0) {
+        SORT_SWAP(dst[i], dst[j]);
+        r[j >> 3] ^= 1 << (j & 7);
     }
 }
 
-
-static void SQRT_SORT_MERGE_RIGHT(SORT_TYPE *arr, int L1, int L2, int M)
+void WEAK_HEAP_SORT(SORT_TYPE *dst, const size_t size)
+{
+    unsigned char *r;
+    size_t i, j, x, y;
+
+    /* don't bother sorting an array of size <= 1 */
+    if (size <= 1) {
+        return;
+    }
+
+    r = kcalloc((size + 7) >> 3, 1, GFP_KERNEL);
+
+    if (r == NULL) {
+        HEAP_SORT(dst, size);
+        return;
+    }
+
+    /* each element joins with its distinguished ancestor, the parent of the
+     * nearest ancestor that is a right child */
+    for (j = size - 1; j > 0; j--) {
+        SORT_CHECKPOINT_RANGE(j - 1, j);
+
+        for (i = j; (i & 1) == WEAK_HEAP_BIT(r, i >> 1); i >>= 1)
+            ;
+
+        WEAK_HEAP_JOIN(dst, r, i >> 1, j);
+    }
+
+    for (i = size - 1; i > 1; i--) {
+        SORT_CHECKPOINT_RANGE(i - 1, i);
+        SORT_SWAP(dst[0], dst[i]);
+
+        /* walk down the left spine of the root's subtree, then join the
+         * new root with every element on the way back up */
+        for (x = 1; (y = 2 * x + WEAK_HEAP_BIT(r, x)) < i; x = y)
+            ;
+
+        for (; x > 0; x >>= 1) {
+            WEAK_HEAP_JOIN(dst, r, 0, x);
+        }
+    }
+
+    SORT_SWAP(dst[0], dst[1]);
+    kfree(r);
+}
+
+#undef WEAK_HEAP_BIT
+
+/* smooth sort: Dijkstra, "Smoothsort, an alternative for sorting in situ".
+ * The array is kept as a forest of max-heaps whose sizes are decreasing
+ * Leonardo numbers, with the roots in ascending order; a heap of order k
+ * has its root last, its right child heap of order k - 2 just before it and
+ * its left child heap of order k - 1 before that.  Sorted input never
+ * moves, so the sort approaches O(n) as the input gets sorted, while the
+ * worst case stays O(n log n) with O(1) extra memory.
+ *
+ * The shape of the forest is a bit mask of the orders present, shifted so
+ * that bit 0 is the order of the last heap, as in the musl libc qsort().
+ * One 64-bit mask suffices below leonardo_numbers[63], about 2 * 10^13
+ * elements. */
+
+/* restore the heap of the given order rooted at head, whose children are
+ * heaps already */
+static __inline void SMOOTH_SORT_SIFT(SORT_TYPE *dst, size_t head, int order)
+{
+    SORT_TYPE val = dst[head];
+
+    while (order > 1) {
+        const size_t rt = head - 1;
+        const size_t lf = rt - leonardo_numbers[order - 2];
+        size_t child = rt;
+        int child_order = order - 2;
+
+        if (SORT_CMP(dst[lf], dst[rt]) >= 0) {
+            child = lf;
+            child_order = order - 1;
+        }
+
+        if (SORT_CMP(val, dst[child]) >= 0) {
+            break;
+        }
+
+        dst[head] = dst[child];
+        head = child;
+        order = child_order;
+    }
+
+    dst[head] = val;
+}
+
+/* move the root at head left along the roots of the forest described by
+ * mask and order until the roots are ascending, then sift it into the heap
+ * it ends up in.  A trusty root is known not to be smaller than its
+ * children. */
+static __inline void SMOOTH_SORT_TRINKLE(SORT_TYPE *dst,
+                                         size_t head,
+                                         uint64_t mask,
+                                         int order,
+                                         int trusty)
+{
+    SORT_TYPE val = dst[head];
+
+    while (mask != 1) {
+        const size_t stepson = head - leonardo_numbers[order];
+        int trail;
+
+        if (SORT_CMP(dst[stepson], val) <= 0) {
+            break;
+        }
+
+        if (!trusty && order > 1) {
+            const size_t rt = head - 1;
+            const size_t lf = rt - leonardo_numbers[order - 2];
+
+            if (SORT_CMP(dst[rt], dst[stepson]) >= 0 ||
+                SORT_CMP(dst[lf], dst[stepson]) >= 0) {
+                break;
+            }
+        }
+
+        dst[head] = dst[stepson];
+        head = stepson;
+        /* skip to the next heap to the left */
+        trail = __builtin_ctzll(mask - 1);
+        mask >>= trail;
+        order += trail;
+        trusty = 0;
+    }
+
+    dst[head] = val;
+
+    if (!trusty) {
+        SMOOTH_SORT_SIFT(dst, head, order);
+    }
+}
+
+void SMOOTH_SORT(SORT_TYPE *dst, const size_t size)
+{
+    uint64_t mask = 1;
+    int order = 1, trail;
+    size_t head = 0;
+
+    /* don't bother sorting an array of size <= 1 */
+    if (size <= 1) {
+        return;
+    }
+
+    /* grow the forest one element at a time; a new element either merges
+     * the last two heaps, if their orders are adjacent, or starts a heap of
+     * order 1 or 0 */
+    while (head < size - 1) {
+        SORT_CHECKPOINT_RANGE(head, head + 1);
+
+        if ((mask & 3) == 3) {
+            SMOOTH_SORT_SIFT(dst, head, order);
+            mask >>= 2;
+            order += 2;
+        } else {
+            /* only a heap that stays a root until the end needs its root
+             * ordered against the other roots now */
+            if (leonardo_numbers[order - 1] >= size - 1 - head) {
+                SMOOTH_SORT_TRINKLE(dst, head, mask, order, 0);
+            } else {
+                SMOOTH_SORT_SIFT(dst, head, order);
+            }
+
+            if (order == 1) {
+                mask <<= 1;
+                order = 0;
+            } else {
+                mask <<= order - 1;
+                order = 1;
+            }
+        }
+
+        mask |= 1;
+        head++;
+    }
+
+    SMOOTH_SORT_TRINKLE(dst, head, mask, order, 0);
+
+    /* shrink it again: the last root is the maximum, and removing it
+     * exposes its two children as roots to trinkle into place */
+    while (order != 1 || mask != 1) {
+        SORT_CHECKPOINT_RANGE(head - 1, head);
+
+        if (order <= 1) {
+            trail = __builtin_ctzll(mask - 1);
+            mask >>= trail;
+            order += trail;
+        } else {
+            mask <<= 2;
+            order -= 2;
+            mask ^= 7;
+            mask >>= 1;
+            SMOOTH_SORT_TRINKLE(dst, head - leonardo_numbers[order] - 1, mask,
+                                order + 1, 1);
+            mask <<= 1;
+            mask |= 1;
+            SMOOTH_SORT_TRINKLE(dst, head - 1, mask, order, 1);
+        }
+
+        head--;
+    }
+}
+
+/********* Sqrt sorting *********************************/
+/*                                                       */
+/* (c) 2014 by Andrey Astrelin                           */
+/*                                                       */
+/*                                                       */
+/* Stable sorting that works in O(N*log(N)) worst time   */
+/* and uses O(sqrt(N)) extra memory                      */
+/*                                                       */
+/* Define SORT_TYPE and SORT_CMP                         */
+/* and then call SqrtSort() function                     */
+/*                                                       */
+/*********************************************************/
+
+#define SORT_CMP_A(a, b) SORT_CMP(*(a), *(b))
+
+static __inline void SQRT_SORT_SWAP_1(SORT_TYPE *a, SORT_TYPE *b)
+{
+    SORT_TYPE c = *a;
+    *a++ = *b;
+    *b++ = c;
+}
+
+static __inline void SQRT_SORT_SWAP_N(SORT_TYPE *a, SORT_TYPE *b, int n)
+{
+    while (n--) {
+        SQRT_SORT_SWAP_1(a++, b++);
+    }
+}
+
+
+static void SQRT_SORT_MERGE_RIGHT(SORT_TYPE *arr, int L1, int L2, int M)
 {
     int p0 = L1 + L2 + M - 1, p2 = L1 + L2 - 1, p1 = L1 - 1;
 
@@ -2027,21 +3009,7 @@ static void SQRT_SORT_MERGE_LEFT_WITH_X_BUF(SORT_TYPE *arr,
                                             int L2,
                                             int M)
 {
-    int p0 = 0, p1 = L1;
-    L2 += L1;
-
-    while (p1 < L2) {
-        if (p0 == L1 || SORT_CMP_A(arr + p0, arr + p1) > 0) {
-            arr[M++] = arr[p1++];
-        } else {
-            arr[M++] = arr[p0++];
-        }
-    }
-
-    if (M != p0)
-        while (p0 < L1) {
-            arr[M++] = arr[p0++];
-        }
+    MERGE_TWO(arr + M, arr, L1, arr + L1, L2);
 }
 
 /* arr[0,L1-1] ++ arr2[0,L2-1] -> arr[-L1,L2-1],  arr2 is "before" arr1 */
@@ -2637,21 +3605,7 @@ static void GRAIL_SMART_MERGE_WITHOUT_BUFFER(SORT_TYPE *arr,
 /* arr[M..-1] - kfree, arr[0,L1-1]++arr[L1,L1+L2-1] -> arr[M,M+L1+L2-1] */
 static void GRAIL_MERGE_LEFT_WITH_X_BUF(SORT_TYPE *arr, int L1, int L2, int M)
 {
-    int p0 = 0, p1 = L1;
-    L2 += L1;
-
-    while (p1 < L2) {
-        if (p0 == L1 || SORT_CMP_A(arr + p0, arr + p1) > 0) {
-            arr[M++] = arr[p1++];
-        } else {
-            arr[M++] = arr[p0++];
-        }
-    }
-
-    if (M != p0)
-        while (p0 < L1) {
-            arr[M++] = arr[p0++];
-        }
+    MERGE_TWO(arr + M, arr, L1, arr + L1, L2);
 }
 
 static void GRAIL_SMART_MERGE_WITH_X_BUF(SORT_TYPE *arr,
@@ -3276,7 +4230,548 @@ void BUBBLE_SORT(SORT_TYPE *dst, const size_t size)
     }
 }
 
+#ifdef SORT_RADIX_KEY
+/* LSD radix sort on the unsigned 64-bit key SORT_RADIX_KEY(x), which the
+ * includer defines to map SORT_TYPE to a key of the same order.  All eight
+ * byte histograms are built in a single read pass, and bytes that are equal
+ * for every element are skipped, so narrow key ranges take fewer passes.
+ * Passes alternate between dst and one buffer, like MERGE_SORT_BOTTOM_UP. */
+void RADIX_SORT(SORT_TYPE *dst, const size_t size)
+{
+    size_t(*count)[256];
+    SORT_TYPE *buf, *src, *out, *tmp;
+    size_t i;
+    int d;
+
+    if (size <= SMALL_SORT_BND) {
+        BINARY_INSERTION_SORT(dst, size);
+        return;
+    }
+
+    count = kmalloc(sizeof(*count) * 8, GFP_KERNEL);
+    buf = SORT_NEW_BUFFER(size);
+
+    if (count == NULL || buf == NULL) {
+        kfree(count);
+        SORT_DELETE_BUFFER(buf);
+        QUICK_SORT(dst, size);
+        return;
+    }
+
+    memset(count, 0, sizeof(*count) * 8);
+
+    for (i = 0; i < size; i++) {
+        const uint64_t key = SORT_RADIX_KEY(dst[i]);
+
+        for (d = 0; d < 8; d++) {
+            count[d][(key >> (8 * d)) & 0xff]++;
+        }
+    }
+
+    src = dst;
+    out = buf;
+
+    for (d = 0; d < 8; d++) {
+        size_t *c = count[d];
+        size_t sum = 0;
+        int b;
+
+        /* every element has the same byte here */
+        if (c[(SORT_RADIX_KEY(src[0]) >> (8 * d)) & 0xff] == size) {
+            continue;
+        }
+
+        if (size >= SORT_CHECKPOINT_MIN) {
+            SORT_CHECKPOINT();
+        }
+
+        for (b = 0; b < 256; b++) {
+            const size_t t = c[b];
+            c[b] = sum;
+            sum += t;
+        }
+
+        for (i = 0; i < size; i++) {
+            out[c[(SORT_RADIX_KEY(src[i]) >> (8 * d)) & 0xff]++] = src[i];
+        }
+
+        tmp = src;
+        src = out;
+        out = tmp;
+    }
+
+    if (src != dst) {
+        SORT_TYPE_CPY(dst, src, size);
+    }
+
+    SORT_DELETE_BUFFER(buf);
+    kfree(count);
+}
+#endif
+
+/* Adaptive sort.  A cheap probe estimates how presorted the input is and how
+ * many duplicates it has, then the input is handed to the engine that does
+ * best on such data:
+ *
+ * - at most SMALL_SORT_BND elements: the sorting networks (BITONIC_SORT),
+ * - long ascending or descending runs: TIM_SORT,
+ * - few distinct keys, or no SORT_RADIX_KEY: QUICK_SORT, which stops on
+ *   partitions of equal keys,
+ * - otherwise, from AUTO_SORT_RADIX_MIN elements on: RADIX_SORT.
+ *
+ * The probe looks at AUTO_SORT_PROBES stretches of AUTO_SORT_PROBE_LEN
+ * adjacent pairs spread over the array, counting descents as COUNT_RUN
+ * would, and at the first element of each stretch, whose sorted copy gives
+ * the duplicate estimate.  The AUTO_SORT_* thresholds can be overridden
+ * before including this file; RUN_BREAKS, DUPLICATES and RADIX_MIN may read
+ * a variable, as the module parameters of main.c do. */
+#ifndef AUTO_SORT_PROBES
+#define AUTO_SORT_PROBES 16
+#endif
+#ifndef AUTO_SORT_PROBE_LEN
+#define AUTO_SORT_PROBE_LEN 16
+#endif
+/* tim sort when at most this many sampled pairs break the dominant order */
+#ifndef AUTO_SORT_RUN_BREAKS
+#define AUTO_SORT_RUN_BREAKS 8
+#endif
+/* quick sort when at least this many sampled keys repeat */
+#ifndef AUTO_SORT_DUPLICATES
+#define AUTO_SORT_DUPLICATES 8
+#endif
+#ifndef AUTO_SORT_RADIX_MIN
+#define AUTO_SORT_RADIX_MIN 1024
+#endif
+
+void AUTO_SORT(SORT_TYPE *dst, const size_t size)
+{
+    SORT_TYPE sample[AUTO_SORT_PROBES];
+    size_t stride, descents = 0, pairs = 0, dups = 0, p, i;
+
+    if (size <= SMALL_SORT_BND) {
+        BITONIC_SORT(dst, size);
+        return;
+    }
+
+    if (size < AUTO_SORT_PROBES * (AUTO_SORT_PROBE_LEN + 1)) {
+        QUICK_SORT(dst, size);
+        return;
+    }
+
+    stride = size / AUTO_SORT_PROBES;
+
+    for (p = 0; p < AUTO_SORT_PROBES; p++) {
+        const SORT_TYPE *probe = &dst[p * stride];
+
+        for (i = 0; i < AUTO_SORT_PROBE_LEN; i++) {
+            descents += SORT_CMP(probe[i], probe[i + 1]) > 0;
+        }
+
+        pairs += AUTO_SORT_PROBE_LEN;
+        sample[p] = probe[0];
+    }
+
+    if (descents <= AUTO_SORT_RUN_BREAKS ||
+        pairs - descents <= AUTO_SORT_RUN_BREAKS) {
+        TIM_SORT(dst, size);
+        return;
+    }
+
+    BITONIC_SORT(sample, AUTO_SORT_PROBES);
+
+    for (p = 1; p < AUTO_SORT_PROBES; p++) {
+        dups += SORT_CMP(sample[p - 1], sample[p]) == 0;
+    }
+
+#ifdef SORT_RADIX_KEY
+    if (dups < AUTO_SORT_DUPLICATES && size >= AUTO_SORT_RADIX_MIN) {
+        RADIX_SORT(dst, size);
+        return;
+    }
+#endif
+
+    QUICK_SORT(dst, size);
+}
+
+#ifdef SORT_PAYLOAD_TYPE
+/* Key/payload sorting.  The KV_* engines sort a dense array of SORT_TYPE keys
+ * and move vals[i], of SORT_PAYLOAD_TYPE, whenever keys[i] moves; payloads
+ * are never compared.  Compared with sorting records that embed the payload,
+ * compares and the cache lines they touch stay those of the bare keys, and
+ * swaps of large payloads aren't paid for on every compare.  To permute
+ * several arrays by one key array, use an index payload (vals[i] = i) and
+ * gather the other arrays through it afterwards. */
+#define KV_SWAP(i, j)                        \
+    {                                        \
+        SORT_SWAP(keys[i], keys[j]);         \
+        SORT_PAYLOAD_SWAP(vals[i], vals[j]); \
+    }
+
+static void KV_INSERTION_SORT(SORT_TYPE *keys,
+                              SORT_PAYLOAD_TYPE *vals,
+                              const size_t size)
+{
+    size_t i, j;
+
+    for (i = 1; i < size; i++) {
+        const SORT_TYPE k = keys[i];
+        const SORT_PAYLOAD_TYPE v = vals[i];
+
+        for (j = i; j > 0 && SORT_CMP(k, keys[j - 1]) < 0; j--) {
+            keys[j] = keys[j - 1];
+            vals[j] = vals[j - 1];
+        }
+
+        keys[j] = k;
+        vals[j] = v;
+    }
+}
+
+static __inline void KV_HEAP_SIFT_DOWN(SORT_TYPE *keys,
+                                       SORT_PAYLOAD_TYPE *vals,
+                                       size_t root,
+                                       const size_t size)
+{
+    size_t child;
+
+    while ((child = 2 * root + 1) < size) {
+        if (child + 1 < size && SORT_CMP(keys[child], keys[child + 1]) < 0) {
+            child++;
+        }
+
+        if (SORT_CMP(keys[root], keys[child]) >= 0) {
+            return;
+        }
+
+        KV_SWAP(root, child);
+        root = child;
+    }
+}
+
+static void KV_HEAP_SORT(SORT_TYPE *keys,
+                         SORT_PAYLOAD_TYPE *vals,
+                         const size_t size)
+{
+    size_t i;
+
+    for (i = size / 2; i-- > 0;) {
+        SORT_CHECKPOINT_RANGE(i, i + 1);
+        KV_HEAP_SIFT_DOWN(keys, vals, i, size);
+    }
+
+    for (i = size; i-- > 1;) {
+        SORT_CHECKPOINT_RANGE(i, i + 1);
+        KV_SWAP(0, i);
+        KV_HEAP_SIFT_DOWN(keys, vals, 0, i);
+    }
+}
+
+/* MEDIAN for the key array; returns the index of the median of the three. */
+static __inline size_t KV_MEDIAN(const SORT_TYPE *keys,
+                                 const size_t a,
+                                 const size_t b,
+                                 const size_t c)
+{
+    if (SORT_CMP(keys[a], keys[b]) < 0) {
+        if (SORT_CMP(keys[b], keys[c]) < 0) {
+            return b;
+        }
+
+        return SORT_CMP(keys[a], keys[c]) < 0 ? c : a;
+    }
+
+    if (SORT_CMP(keys[a], keys[c]) < 0) {
+        return a;
+    }
+
+    return SORT_CMP(keys[b], keys[c]) < 0 ? c : b;
+}
+
+/* QUICK_SORT_RECURSIVE on [left, right] of the key array, moving payloads
+ * with the keys. */
+static void KV_QUICK_SORT_RECURSIVE(SORT_TYPE *keys,
+                                    SORT_PAYLOAD_TYPE *vals,
+                                    size_t left,
+                                    size_t right)
+{
+    int loop_count = 0;
+    int max_loops;
+
+    if (right <= left) {
+        return;
+    }
+
+    max_loops = 64 - CLZ(right - left); /* ~lg N */
+
+    while (right > left) {
+        size_t middle, pivot, index, i;
+        int not_all_same = 0;
+        SORT_TYPE value;
+
+        if (right - left + 1U <= SMALL_SORT_BND) {
+            KV_INSERTION_SORT(&keys[left], &vals[left], right - left + 1U);
+            return;
+        }
+
+        if (++loop_count >= max_loops) {
+            KV_HEAP_SORT(&keys[left], &vals[left], right - left + 1U);
+            return;
+        }
+
+        SORT_CHECKPOINT_RANGE(left, right);
+
+        /* median of 5 */
+        middle = left + ((right - left) >> 1);
+        pivot = KV_MEDIAN(keys, left, middle, right);
+        pivot = KV_MEDIAN(keys, left + ((middle - left) >> 1), pivot,
+                          middle + ((right - middle) >> 1));
+
+        value = keys[pivot];
+        KV_SWAP(pivot, right);
+        index = left;
+
+        for (i = left; i < right; i++) {
+            const int cmp = SORT_CMP(keys[i], value);
+            not_all_same |= cmp;
+
+            if (cmp < 0) {
+                KV_SWAP(i, index);
+                index++;
+            }
+        }
+
+        KV_SWAP(right, index);
+
+        if (not_all_same == 0) {
+            return;
+        }
+
+        /* recurse on the small part, loop on the large one */
+        if (index - left > right - index) {
+            KV_QUICK_SORT_RECURSIVE(keys, vals, index + 1U, right);
+            right = index - 1U;
+        } else {
+            if (index > left) {
+                KV_QUICK_SORT_RECURSIVE(keys, vals, left, index - 1U);
+            }
+
+            left = index + 1U;
+        }
+    }
+}
+
+/* Unstable key/payload sort, QUICK_SORT with payloads in tow. */
+void KV_QUICK_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size)
+{
+    if (size <= 1) {
+        return;
+    }
+
+    KV_QUICK_SORT_RECURSIVE(keys, vals, 0U, size - 1U);
+}
+
+/* MERGE_TWO on key/payload pairs; the outputs must not alias the inputs. */
+static __inline void KV_MERGE_TWO(SORT_TYPE *ko,
+                                  SORT_PAYLOAD_TYPE *vo,
+                                  const SORT_TYPE *ka,
+                                  const SORT_PAYLOAD_TYPE *va,
+                                  const size_t na,
+                                  const SORT_TYPE *kb,
+                                  const SORT_PAYLOAD_TYPE *vb,
+                                  const size_t nb)
+{
+    size_t i = 0, j = 0;
+
+    /* both heads are loaded before selecting, so that the payload move
+     * doesn't turn into a branch on the comparison */
+    while (i < na && j < nb) {
+        const SORT_TYPE a = ka[i], b = kb[j];
+        const SORT_PAYLOAD_TYPE x = va[i], y = vb[j];
+        const int take_b = SORT_CMP(b, a) < 0;
+        *ko++ = take_b ? b : a;
+        *vo++ = take_b ? y : x;
+        j += take_b;
+        i += !take_b;
+    }
+
+    memcpy(ko, &ka[i], (na - i) * sizeof(*ko));
+    memcpy(vo, &va[i], (na - i) * sizeof(*vo));
+    ko += na - i;
+    vo += na - i;
+    memcpy(ko, &kb[j], (nb - j) * sizeof(*ko));
+    memcpy(vo, &vb[j], (nb - j) * sizeof(*vo));
+}
+
+/* Stable key/payload sort, MERGE_SORT_BOTTOM_UP with payloads in tow.  It
+ * needs a buffer for n keys and n payloads; without one it falls back to
+ * KV_QUICK_SORT, which isn't stable. */
+void KV_MERGE_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size)
+{
+    SORT_TYPE *kbuf, *ksrc, *kout, *ktmp;
+    SORT_PAYLOAD_TYPE *vbuf, *vsrc, *vout, *vtmp;
+    size_t run = SMALL_SORT_BND;
+    size_t width, lo;
+    int passes = 0;
+
+    if (size <= SMALL_SORT_BND) {
+        KV_INSERTION_SORT(keys, vals, size);
+        return;
+    }
+
+    kbuf = SORT_NEW_BUFFER(size);
+    vbuf = kmalloc(size * sizeof(*vbuf), GFP_KERNEL);
+
+    if (kbuf == NULL || vbuf == NULL) {
+        SORT_DELETE_BUFFER(kbuf);
+        kfree(vbuf);
+        KV_QUICK_SORT(keys, vals, size);
+        return;
+    }
+
+    for (width = run; width < size; width *= 2) {
+        passes++;
+    }
+
+    if ((passes & 1) && run > 1) {
+        run = (run + 1) / 2;
+    }
+
+    for (lo = 0; lo < size; lo += run) {
+        KV_INSERTION_SORT(&keys[lo], &vals[lo], MIN(run, size - lo));
+    }
+
+    ksrc = keys;
+    vsrc = vals;
+    kout = kbuf;
+    vout = vbuf;
+
+    for (width = run; width < size; width *= 2) {
+        for (lo = 0; lo < size; lo += 2 * width) {
+            const size_t mid = MIN(lo + width, size);
+            const size_t hi = MIN(lo + 2 * width, size);
+            SORT_CHECKPOINT_RANGE(lo, hi);
+            KV_MERGE_TWO(&kout[lo], &vout[lo], &ksrc[lo], &vsrc[lo], mid - lo,
+                         &ksrc[mid], &vsrc[mid], hi - mid);
+        }
+
+        ktmp = ksrc;
+        ksrc = kout;
+        kout = ktmp;
+        vtmp = vsrc;
+        vsrc = vout;
+        vout = vtmp;
+    }
+
+    if (ksrc != keys) {
+        memcpy(keys, ksrc, size * sizeof(*keys));
+        memcpy(vals, vsrc, size * sizeof(*vals));
+    }
+
+    kfree(vbuf);
+    SORT_DELETE_BUFFER(kbuf);
+}
+
+#ifdef SORT_RADIX_KEY
+/* Stable key/payload sort, RADIX_SORT with payloads in tow.  Without memory
+ * for the count arrays and the n key and payload buffer it falls back to
+ * KV_QUICK_SORT, which isn't stable. */
+void KV_RADIX_SORT(SORT_TYPE *keys, SORT_PAYLOAD_TYPE *vals, const size_t size)
+{
+    size_t(*count)[256];
+    SORT_TYPE *kbuf, *ksrc, *kout, *ktmp;
+    SORT_PAYLOAD_TYPE *vbuf, *vsrc, *vout, *vtmp;
+    size_t i;
+    int d;
+
+    if (size <= SMALL_SORT_BND) {
+        KV_INSERTION_SORT(keys, vals, size);
+        return;
+    }
+
+    count = kmalloc(sizeof(*count) * 8, GFP_KERNEL);
+    kbuf = SORT_NEW_BUFFER(size);
+    vbuf = kmalloc(size * sizeof(*vbuf), GFP_KERNEL);
+
+    if (count == NULL || kbuf == NULL || vbuf == NULL) {
+        kfree(count);
+        SORT_DELETE_BUFFER(kbuf);
+        kfree(vbuf);
+        KV_QUICK_SORT(keys, vals, size);
+        return;
+    }
+
+    memset(count, 0, sizeof(*count) * 8);
+
+    for (i = 0; i < size; i++) {
+        const uint64_t key = SORT_RADIX_KEY(keys[i]);
+
+        for (d = 0; d < 8; d++) {
+            count[d][(key >> (8 * d)) & 0xff]++;
+        }
+    }
+
+    ksrc = keys;
+    vsrc = vals;
+    kout = kbuf;
+    vout = vbuf;
+
+    for (d = 0; d < 8; d++) {
+        size_t *c = count[d];
+        size_t sum = 0;
+        int b;
+
+        /* every key has the same byte here */
+        if (c[(SORT_RADIX_KEY(ksrc[0]) >> (8 * d)) & 0xff] == size) {
+            continue;
+        }
+
+        if (size >= SORT_CHECKPOINT_MIN) {
+            SORT_CHECKPOINT();
+        }
+
+        for (b = 0; b < 256; b++) {
+            const size_t t = c[b];
+            c[b] = sum;
+            sum += t;
+        }
+
+        for (i = 0; i < size; i++) {
+            const size_t o = c[(SORT_RADIX_KEY(ksrc[i]) >> (8 * d)) & 0xff]++;
+            kout[o] = ksrc[i];
+            vout[o] = vsrc[i];
+        }
+
+        ktmp = ksrc;
+        ksrc = kout;
+        kout = ktmp;
+        vtmp = vsrc;
+        vsrc = vout;
+        vout = vtmp;
+    }
+
+    if (ksrc != keys) {
+        memcpy(keys, ksrc, size * sizeof(*keys));
+        memcpy(vals, vsrc, size * sizeof(*vals));
+    }
+
+    kfree(vbuf);
+    SORT_DELETE_BUFFER(kbuf);
+    kfree(count);
+}
+#endif
+
+#undef KV_SWAP
+#endif
+
 #undef SORT_SAFE_CPY
+#undef SORT_CHECKPOINT
+#undef SORT_CHECKPOINT_MIN
+#undef SORT_CHECKPOINT_RANGE
+#undef SORT_TRACE_TIM_PUSH
+#undef SORT_TRACE_TIM_MERGE
+#undef SORT_TRACE_NEW_BUFFER
+#undef SORT_PROFILE_BEGIN
+#undef SORT_PROFILE_END
 #undef SORT_TYPE_CPY
 #undef SORT_TYPE_MOVE
 #undef SORT_NEW_BUFFER
@@ -3304,10 +4799,22 @@ void BUBBLE_SORT(SORT_TYPE *dst, const size_t size)
 #undef TIM_SORT
 #undef TIM_SORT_RESIZE
 #undef TIM_SORT_COLLAPSE
+#undef POWER_SORT
 #undef TIM_SORT_RUN_T
 #undef TEMP_STORAGE_T
 #undef MERGE_SORT
 #undef MERGE_SORT_RECURSIVE
+#undef MERGE_SORT_BOTTOM_UP
+#undef MERGE_TWO
+#undef MERGE_K
+#undef MERGE_K_BEATS
+#undef SORT_VEC_T
+#undef SORT_VEC_MASK_T
+#undef SORT_VEC_MINMAX
+#undef SORT_VEC_SHUF2
+#undef SORT_VEC_LANES
+#undef BITONIC_MERGE_VEC
+#undef SORT_SIMD_MERGE
 #undef MERGE_SORT_IN_PLACE
 #undef MERGE_SORT_IN_PLACE_RMERGE
 #undef MERGE_SORT_IN_PLACE_BACKMERGE
@@ -3350,4 +4857,23 @@ void BUBBLE_SORT(SORT_TYPE *dst, const size_t size)
 #undef SQRT_SORT_COMBINE_BLOCKS
 #undef SQRT_SORT_COMMON_SORT
 #undef SORT_CMP_A
-#undef BUBBLE_SORT
\ No newline at end of file
+#undef BUBBLE_SORT
+#undef RADIX_SORT
+#undef AUTO_SORT
+#undef KV_INSERTION_SORT
+#undef KV_HEAP_SIFT_DOWN
+#undef KV_HEAP_SORT
+#undef KV_MEDIAN
+#undef KV_QUICK_SORT_RECURSIVE
+#undef KV_QUICK_SORT
+#undef KV_MERGE_TWO
+#undef KV_MERGE_SORT
+#undef WEAK_HEAP_JOIN
+#undef WEAK_HEAP_SORT
+#undef SMOOTH_SORT_SIFT
+#undef SMOOTH_SORT_TRINKLE
+#undef SMOOTH_SORT
+#undef KV_RADIX_SORT
+#undef SORT_PAYLOAD_TYPE
+#undef SORT_PAYLOAD_SWAP
+#undef SORT_RADIX_KEY
\ No newline at end of file
@@ -5,6 +5,7 @@ typedef void (*swap_func_t)(void *a, void *b, int size);
 
 typedef int (*cmp_r_func_t)(const void *a, const void *b, const void *priv);
 typedef int (*cmp_func_t)(const void *a, const void *b);
+typedef u64 (*prefix_func_t)(const void *a);
 
 extern void sort_heap(void *base,
                       size_t num,
@@ -12,6 +13,22 @@ extern void sort_heap(void *base,
                       cmp_func_t cmp_func,
                       swap_func_t swap_func);
 
+extern void sort_heap_r(void *base,
+                        size_t num,
+                        size_t size,
+                        cmp_r_func_t cmp_func,
+                        swap_func_t swap_func,
+                        const void *priv);
+
+/*
+ * sort_heap() and sort_heap_r() switch from a binary to a 4-ary heap for
+ * arrays of at least this many bytes, where the cache misses of the extra
+ * levels cost more than the extra compares of the wider one.
+ */
+#ifndef KSORT_HEAP_QUAD_MIN_BYTES
+#define KSORT_HEAP_QUAD_MIN_BYTES (4 << 20)
+#endif
+
 extern void sort_intro(void *_array,
                        size_t length,
                        size_t data_size,
@@ -24,4 +41,165 @@ extern void sort_pdqsort(void *base,
                          cmp_func_t cmp_func,
                          swap_func_t swap_func);
 
+/*
+ * sort_heap(), sort_intro() and sort_pdqsort() carry copies of their sorting
+ * loops compiled for the element sizes 4, 8, 12, 16 and 32, so that the
+ * offset arithmetic folds and the built-in swaps become a few fixed moves.
+ * Other sizes, or all of them while ksort_specialize is false, take the
+ * generic loops.
+ */
+extern bool ksort_specialize;
+
+/*
+ * Cooperative mode.  While ksort_cooperative is set, the long-running sorts
+ * call cond_resched() between partitions, merges or heap passes, at most
+ * about once every KSORT_CHECKPOINT_MIN elements of work, so that sorting a
+ * huge array does not trip the soft-lockup detector.  The inner loops are
+ * left alone.  Callers must not hold a spinlock or have preemption disabled
+ * while it is set.  Includers need <linux/sched.h>.
+ */
+extern bool ksort_cooperative;
+
+/*
+ * Tuning thresholds of the engines.  They are module parameters, read/write
+ * at any time, and the calibrate parameter picks them for the running CPU,
+ * see main.c.  A sort running across a change may see both values, which
+ * only affects its speed.
+ *
+ * sort_pdqsort() insertion sorts ranges below ksort_pdq_insertion_threshold
+ * elements, takes Tukey's ninther as pivot above ksort_pdq_ninther_threshold
+ * and gives up on finishing a range by insertion after
+ * ksort_pdq_partial_insertion_limit element moves.  sort_intro() leaves
+ * ranges of up to ksort_intro_threshold elements to its final insertion pass.
+ */
+extern unsigned int ksort_pdq_insertion_threshold;
+extern unsigned int ksort_pdq_ninther_threshold;
+extern unsigned int ksort_pdq_partial_insertion_limit;
+extern unsigned int ksort_intro_threshold;
+
+#ifndef KSORT_CHECKPOINT_MIN
+#define KSORT_CHECKPOINT_MIN 4096 /* a power of two */
+#endif
+
+#define ksort_checkpoint()     \
+    do {                       \
+        if (ksort_cooperative) \
+            cond_resched();    \
+    } while (0)
+
+/*
+ * Indirect sorting, see indirect.c.  sort_intro() and sort_pdqsort() switch
+ * to it for elements of at least KSORT_INDIRECT_MIN_SIZE bytes when they use
+ * the built-in swaps.  sort_heap() does not, to keep its O(1) memory.
+ */
+#ifndef KSORT_INDIRECT_MIN_SIZE
+#define KSORT_INDIRECT_MIN_SIZE 128
+#endif
+
+extern int ksort_indirect(void *base,
+                          size_t num,
+                          size_t size,
+                          cmp_func_t cmp_func,
+                          prefix_func_t prefix_func);
+
+/*
+ * Whether an engine allocates, and so may sleep, when sorting elements of
+ * size bytes: sort_intro() and sort_pdqsort() take their stacks from
+ * kmalloc(), and hand elements of KSORT_INDIRECT_MIN_SIZE bytes on to
+ * ksort_indirect(), which allocates too.  sort_heap() never allocates.
+ */
+#define sort_intro_allocates(size) true
+#define sort_pdqsort_allocates(size) true
+
+extern int ksort_indirect_less(void *base,
+                               size_t num,
+                               size_t size,
+                               cmp_func_t cmp_func,
+                               prefix_func_t prefix_func);
+
+/*
+ * Selection built on the pdqsort partitioner; cmp_func is a "less than"
+ * predicate like for sort_pdqsort().
+ *
+ * ksort_select() moves the element of rank k to index k, with no greater
+ * element before it and no smaller one after it, in O(n) average time.
+ * ksort_partial_sort() leaves the k smallest elements sorted in [0, k).
+ * Selection moves elements with the built-in swaps; the swap_func of
+ * ksort_partial_sort() is passed on to sort_pdqsort() for the final sort.
+ */
+extern void ksort_select(void *base,
+                         size_t num,
+                         size_t size,
+                         size_t k,
+                         cmp_func_t cmp_func);
+
+extern void ksort_partial_sort(void *base,
+                               size_t num,
+                               size_t size,
+                               size_t k,
+                               cmp_func_t cmp_func,
+                               swap_func_t swap_func);
+
+/*
+ * Bounded-heap top-k built on the heapsort of heap.c; cmp_func is a
+ * three-way comparison like for sort_heap().
+ *
+ * ksort_topk() leaves the k smallest elements of an array sorted in [0, k).
+ * The ksort_topk_*() calls do the same for a stream, keeping the k smallest
+ * elements pushed so far in a caller-provided buffer of k elements.
+ */
+struct ksort_topk {
+    void *heap;
+    size_t k, size, n;
+    cmp_func_t cmp_func;
+    swap_func_t swap_func;
+};
+
+extern void ksort_topk(void *base,
+                       size_t num,
+                       size_t size,
+                       size_t k,
+                       cmp_func_t cmp_func,
+                       swap_func_t swap_func);
+
+extern void ksort_topk_init(struct ksort_topk *t,
+                            void *heap,
+                            size_t k,
+                            size_t size,
+                            cmp_func_t cmp_func,
+                            swap_func_t swap_func);
+
+extern void ksort_topk_push(struct ksort_topk *t, const void *elem);
+
+extern size_t ksort_topk_finish(struct ksort_topk *t);
+
+/*
+ * Resumable sort jobs, see job.c.  ksort_job_run() sorts for up to a time
+ * budget and can be called again later to continue; the job is done when it
+ * returns 0.  The sort is stable and cmp_func is a three-way comparison like
+ * for sort_heap().
+ */
+#ifndef KSORT_JOB_STRIDE
+#define KSORT_JOB_STRIDE 256 /* element moves between clock reads */
+#endif
+
+struct ksort_job {
+    char *base, *buf;
+    char *src, *dst; /* the merge pass in progress reads src, writes dst */
+    size_t num, size, run;
+    cmp_func_t cmp_func;
+    size_t width, lo, mid, hi, i, j;
+    int state;
+};
+
+extern int ksort_job_init(struct ksort_job *job,
+                          void *base,
+                          size_t num,
+                          size_t size,
+                          cmp_func_t cmp_func);
+
+extern int ksort_job_run(struct ksort_job *job, u64 budget_ns);
+
+extern void ksort_job_destroy(struct ksort_job *job);
+
 #endif
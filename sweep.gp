@@ -0,0 +1,17 @@
+reset
+set ylabel 'time(nsec)'
+set xlabel 'element size (bytes)'
+set title 'Element size sweep'
+set term png enhanced font 'Verdana,10'
+set output 'sweep.png'
+set logscale x 2
+set key left top
+
+plot [][] 'sweep.txt' every 2::0 using 1:3 with linespoints linewidth 1 title 'heap', \
+'' every 2::0 using 1:4 with linespoints linewidth 1 title 'intro', \
+'' every 2::0 using 1:5 with linespoints linewidth 1 title 'pdqsort', \
+'' every 2::0 using 1:6 with linespoints linewidth 1 title 'indirect', \
+'' every 2::1 using 1:3 with linespoints linewidth 1 dashtype 2 title 'heap (misaligned)', \
+'' every 2::1 using 1:4 with linespoints linewidth 1 dashtype 2 title 'intro (misaligned)', \
+'' every 2::1 using 1:5 with linespoints linewidth 1 dashtype 2 title 'pdqsort (misaligned)', \
+'' every 2::1 using 1:6 with linespoints linewidth 1 dashtype 2 title 'indirect (misaligned)'